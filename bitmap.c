@@ -0,0 +1,128 @@
+#include <string.h>
+#include "bitmap.h"
+
+/**
+ * Bitmap operations that work on 64 bits at a time.
+ *
+ * Word w holds bits 64w to 64w + 63. It is loaded big-endian, so bit i ends up at position 63 - i % 64 and the
+ * lowest bit of a range is always the most significant one in the word: scans use count-leading-zeros, counts use
+ * popcount, and range updates are a single mask per word. The last word of a bitmap whose size is not a multiple of
+ * 64 bits is loaded and stored only as far as the bitmap's own bytes go.
+ */
+
+static int word_bytes(int nbits, int w) {
+    int n = (nbits + 7) / 8 - 8 * w;
+    return n > 8 ? 8 : n;
+}
+
+/**
+ * Load word w of a bitmap, bit 64w at the most significant end.
+ */
+uint64_t bitmap_load_word(const uint8_t *map, int nbits, int w) {
+    uint64_t x = 0;
+    memcpy(&x, map + 8 * w, word_bytes(nbits, w));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+void bitmap_store_word(uint8_t *map, int nbits, int w, uint64_t x) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    memcpy(map + 8 * w, &x, word_bytes(nbits, w));
+}
+
+/**
+ * Mask of the bits 64w + a to 64w + b - 1 of word w, 0 <= a < b <= 64.
+ */
+uint64_t bitmap_word_mask(int a, int b) {
+    uint64_t from_a = ~0ull >> a;
+    uint64_t from_b = (b >= 64) ? 0 : ~0ull >> b;
+    return from_a & ~from_b;
+}
+
+static void update_range(uint8_t *map, int nbits, int start, int count, int set) {
+    int end = start + count;
+    if (start < 0) start = 0;
+    if (end > nbits) end = nbits;
+    for (int w = start / 64; 64 * w < end; w++) {
+        int a = (start > 64 * w) ? start - 64 * w : 0;
+        int b = (end < 64 * w + 64) ? end - 64 * w : 64;
+        uint64_t x = bitmap_load_word(map, nbits, w);
+        uint64_t m = bitmap_word_mask(a, b);
+        bitmap_store_word(map, nbits, w, set ? (x | m) : (x & ~m));
+    }
+}
+
+static int next_match(const uint8_t *map, int nbits, int from, int want_set) {
+    if (from < 0) from = 0;
+    for (int w = from / 64; 64 * w < nbits; w++) {
+        uint64_t x = bitmap_load_word(map, nbits, w);
+        if (!want_set) x = ~x;
+        int a = (from > 64 * w) ? from - 64 * w : 0;
+        int b = (nbits < 64 * w + 64) ? nbits - 64 * w : 64;
+        x &= bitmap_word_mask(a, b);
+        if (x) return 64 * w + __builtin_clzll(x);
+    }
+    return -1;
+}
+
+/**
+ * Returns 1 if bit is set, 0 otherwise.
+ */
+int bitmap_test(const uint8_t *map, int bit) {
+    return (map[bit / 8] >> (7 - (bit % 8))) & 1;
+}
+
+/**
+ * Set count bits starting at start. Bits outside the bitmap are ignored.
+ */
+void bitmap_set_range(uint8_t *map, int nbits, int start, int count) {
+    update_range(map, nbits, start, count, 1);
+}
+
+void bitmap_clear_range(uint8_t *map, int nbits, int start, int count) {
+    update_range(map, nbits, start, count, 0);
+}
+
+/**
+ * Find the first set bit at or after from. Returns -1 if there is none.
+ */
+int bitmap_next_set(const uint8_t *map, int nbits, int from) {
+    return next_match(map, nbits, from, 1);
+}
+
+int bitmap_next_zero(const uint8_t *map, int nbits, int from) {
+    return next_match(map, nbits, from, 0);
+}
+
+/**
+ * Find the lowest bit at or after from that starts a run of at least count clear bits. Returns -1 if there is none.
+ */
+int bitmap_find_zero_run(const uint8_t *map, int nbits, int from, int count) {
+    while (1) {
+        int start = bitmap_next_zero(map, nbits, from);
+        if (start < 0 || start + count > nbits) return -1;
+        int end = bitmap_next_set(map, nbits, start);
+        if (end < 0) end = nbits;
+        if (end - start >= count) return start;
+        from = end;
+    }
+}
+
+/**
+ * Count the set bits among the count bits starting at start.
+ */
+int bitmap_count_set(const uint8_t *map, int nbits, int start, int count) {
+    int end = start + count, total = 0;
+    if (start < 0) start = 0;
+    if (end > nbits) end = nbits;
+    for (int w = start / 64; 64 * w < end; w++) {
+        int a = (start > 64 * w) ? start - 64 * w : 0;
+        int b = (end < 64 * w + 64) ? end - 64 * w : 64;
+        total += __builtin_popcountll(bitmap_load_word(map, nbits, w) & bitmap_word_mask(a, b));
+    }
+    return total;
+}
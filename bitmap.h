@@ -0,0 +1,20 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdint.h>
+
+// Bitmaps are arrays of bytes in the on-disk order: bit i is bit 7 - i % 8 of byte i / 8, so the first bit of every
+// byte is its most significant one. A bitmap of nbits bits occupies (nbits + 7) / 8 bytes.
+
+int bitmap_test(const uint8_t *map, int bit);
+void bitmap_set_range(uint8_t *map, int nbits, int start, int count);
+void bitmap_clear_range(uint8_t *map, int nbits, int start, int count);
+int bitmap_next_set(const uint8_t *map, int nbits, int from);
+int bitmap_next_zero(const uint8_t *map, int nbits, int from);
+int bitmap_find_zero_run(const uint8_t *map, int nbits, int from, int count);
+int bitmap_count_set(const uint8_t *map, int nbits, int start, int count);
+uint64_t bitmap_load_word(const uint8_t *map, int nbits, int w);
+void bitmap_store_word(uint8_t *map, int nbits, int w, uint64_t x);
+uint64_t bitmap_word_mask(int a, int b);
+
+#endif
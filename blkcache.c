@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "blkdev.h"
+
+/**
+ * Write-through LRU cache of whole blocks stacked on top of another block device.
+ *
+ * Frames are found through a chained hash keyed by absolute block number and kept on a doubly linked list in
+ * recency order, most recent first. Single-block reads and writes fill frames; larger transfers only refresh
+ * frames that are already cached, so one big scan does not push out the blocks that are read again and again.
+ * Vectored transfers follow the same rules as plain ones over the whole run, except that vectored writes only
+ * drop frames. Zeroing and relocation go to the lower device and drop the frames of every block they touch.
+ */
+
+typedef struct {
+    BlockDevice dev;
+    BlockDevice *lower;
+    int nframes;
+    int nbuckets;          // Power of two
+    int *bucket;           // First frame in each hash chain, -1 if empty
+    int *block;            // Block held by each frame, -1 if free
+    int *chain;            // Next frame in the same hash chain
+    int *prev, *next;      // Recency list
+    int head, tail;        // Most and least recently used frame
+    uint8_t *data;
+    BlockCacheStats stats;
+} BlockCache;
+
+static int bucket_of(BlockCache *c, int block) {
+    return (unsigned)block * 2654435761u & (c->nbuckets - 1);
+}
+
+static int cache_find(BlockCache *c, int block) {
+    for (int f = c->bucket[bucket_of(c, block)]; f >= 0; f = c->chain[f]) {
+        if (c->block[f] == block) return f;
+    }
+    return -1;
+}
+
+static void lru_unlink(BlockCache *c, int f) {
+    if (c->prev[f] >= 0) c->next[c->prev[f]] = c->next[f];
+    else c->head = c->next[f];
+    if (c->next[f] >= 0) c->prev[c->next[f]] = c->prev[f];
+    else c->tail = c->prev[f];
+}
+
+static void lru_push_front(BlockCache *c, int f) {
+    c->prev[f] = -1;
+    c->next[f] = c->head;
+    if (c->head >= 0) c->prev[c->head] = f;
+    c->head = f;
+    if (c->tail < 0) c->tail = f;
+}
+
+static void lru_touch(BlockCache *c, int f) {
+    if (c->head == f) return;
+    lru_unlink(c, f);
+    lru_push_front(c, f);
+}
+
+static void hash_remove(BlockCache *c, int f) {
+    int *link = &c->bucket[bucket_of(c, c->block[f])];
+    while (*link != f) link = &c->chain[*link];
+    *link = c->chain[f];
+}
+
+/**
+ * Drop the frame holding block, if any. A dropped frame becomes the first one to be reused.
+ */
+static void cache_invalidate(BlockCache *c, int block) {
+    int f = cache_find(c, block);
+    if (f < 0) return;
+    hash_remove(c, f);
+    c->block[f] = -1;
+    lru_unlink(c, f);
+    // Append at the tail
+    c->prev[f] = c->tail;
+    c->next[f] = -1;
+    if (c->tail >= 0) c->next[c->tail] = f;
+    c->tail = f;
+    if (c->head < 0) c->head = f;
+}
+
+static void cache_invalidate_range(BlockCache *c, int block, int count) {
+    for (int b = block; b < block + count; b++) cache_invalidate(c, b);
+}
+
+/**
+ * Take the least recently used frame for block and return it, evicting whatever it held.
+ */
+static int cache_insert(BlockCache *c, int block) {
+    int f = c->tail;
+    if (c->block[f] >= 0) {
+        hash_remove(c, f);
+        c->stats.evictions++;
+    }
+    c->block[f] = block;
+    int b = bucket_of(c, block);
+    c->chain[f] = c->bucket[b];
+    c->bucket[b] = f;
+    lru_touch(c, f);
+    return f;
+}
+
+static uint8_t *frame_data(BlockCache *c, int f) {
+    return c->data + (size_t)f * BLOCK_SIZE;
+}
+
+static int cache_read_blocks(BlockDevice *dev, int block, int count, void *buf) {
+    BlockCache *c = (BlockCache *)dev;
+    uint8_t *out = buf;
+    int missing = 0;
+    for (int i = 0; i < count && !missing; i++) {
+        if (cache_find(c, block + i) < 0) missing = 1;
+    }
+
+    // Only blocks copied out of a frame are hits; a run with any block missing is read whole from the device below
+    if (!missing) {
+        c->stats.hits += count;
+        for (int i = 0; i < count; i++) {
+            int f = cache_find(c, block + i);
+            memcpy(out + (size_t)i * BLOCK_SIZE, frame_data(c, f), BLOCK_SIZE);
+            lru_touch(c, f);
+        }
+        return 0;
+    }
+    c->stats.misses += count;
+    if (count == 1) {
+        int f = cache_insert(c, block);
+        if (blkdev_read_blocks(c->lower, block, 1, frame_data(c, f)) < 0) {
+            cache_invalidate(c, block);
+            return -1;
+        }
+        memcpy(out, frame_data(c, f), BLOCK_SIZE);
+        return 0;
+    }
+    // The cache is write-through, so frames already held agree with the disk and the run is read in one go
+    return blkdev_read_blocks(c->lower, block, count, buf);
+}
+
+static int cache_write_blocks(BlockDevice *dev, int block, int count, const void *buf) {
+    BlockCache *c = (BlockCache *)dev;
+    const uint8_t *in = buf;
+    if (blkdev_write_blocks(c->lower, block, count, buf) < 0) {
+        cache_invalidate_range(c, block, count);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        int f = cache_find(c, block + i);
+        if (f < 0 && count > 1) continue;
+        if (f < 0) f = cache_insert(c, block + i);
+        else lru_touch(c, f);
+        memcpy(frame_data(c, f), in + (size_t)i * BLOCK_SIZE, BLOCK_SIZE);
+    }
+    return 0;
+}
+
+/**
+ * Same as cache_read_blocks for a run of blocks scattered over several buffers.
+ */
+static int cache_readv_blocks(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt) {
+    BlockCache *c = (BlockCache *)dev;
+    int count = 0, missing = 0;
+    for (int i = 0; i < iovcnt; i++) count += iov[i].iov_len / BLOCK_SIZE;
+    for (int i = 0; i < count && !missing; i++) {
+        if (cache_find(c, block + i) < 0) missing = 1;
+    }
+    if (missing) {
+        c->stats.misses += count;
+        return blkdev_readv_blocks(c->lower, block, iov, iovcnt);
+    }
+    c->stats.hits += count;
+    for (int i = 0; i < iovcnt; i++) {
+        uint8_t *out = iov[i].iov_base;
+        for (size_t off = 0; off < iov[i].iov_len; off += BLOCK_SIZE) {
+            int f = cache_find(c, block++);
+            memcpy(out + off, frame_data(c, f), BLOCK_SIZE);
+            lru_touch(c, f);
+        }
+    }
+    return 0;
+}
+
+static int cache_writev_blocks(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt) {
+    BlockCache *c = (BlockCache *)dev;
+    int count = 0;
+    for (int i = 0; i < iovcnt; i++) count += iov[i].iov_len / BLOCK_SIZE;
+    cache_invalidate_range(c, block, count);
+    return blkdev_writev_blocks(c->lower, block, iov, iovcnt);
+}
+
+static int cache_zero_blocks(BlockDevice *dev, int block, int count) {
+    BlockCache *c = (BlockCache *)dev;
+    cache_invalidate_range(c, block, count);
+    return blkdev_zero_blocks(c->lower, block, count);
+}
+
+static int cache_move_blocks(BlockDevice *dev, const BlockMove *moves, int n) {
+    BlockCache *c = (BlockCache *)dev;
+    for (int i = 0; i < n; i++) {
+        cache_invalidate_range(c, moves[i].src, moves[i].count);
+        cache_invalidate_range(c, moves[i].dst, moves[i].count);
+    }
+    return blkdev_move_blocks(c->lower, moves, n);
+}
+
+static int cache_flush(BlockDevice *dev) {
+    BlockCache *c = (BlockCache *)dev;
+    return blkdev_flush(c->lower);
+}
+
+static void cache_close(BlockDevice *dev) {
+    BlockCache *c = (BlockCache *)dev;
+    blkdev_close(c->lower);
+    free(c->bucket);
+    free(c->block);
+    free(c->chain);
+    free(c->prev);
+    free(c->next);
+    free(c->data);
+    free(c);
+}
+
+static const BlockDeviceOps cache_ops = {
+    .read_blocks = cache_read_blocks,
+    .write_blocks = cache_write_blocks,
+    .readv_blocks = cache_readv_blocks,
+    .writev_blocks = cache_writev_blocks,
+    .zero_blocks = cache_zero_blocks,
+    .flush = cache_flush,
+    .close = cache_close,
+    .move_blocks = cache_move_blocks,
+};
+
+/**
+ * Put a cache of nframes blocks in front of lower. The cache takes ownership of lower and closes it with itself.
+ * Returns NULL, leaving lower untouched, if nframes is not positive or memory runs out.
+ */
+BlockDevice *blkdev_open_cache(BlockDevice *lower, int nframes) {
+    if (nframes <= 0) return NULL;
+    BlockCache *c = calloc(1, sizeof(BlockCache));
+    if (!c) return NULL;
+    c->nbuckets = 1;
+    while (c->nbuckets < 2 * nframes) c->nbuckets <<= 1;
+    c->bucket = malloc(c->nbuckets * sizeof(int));
+    c->block = malloc(nframes * sizeof(int));
+    c->chain = malloc(nframes * sizeof(int));
+    c->prev = malloc(nframes * sizeof(int));
+    c->next = malloc(nframes * sizeof(int));
+    c->data = malloc((size_t)nframes * BLOCK_SIZE);
+    if (!c->bucket || !c->block || !c->chain || !c->prev || !c->next || !c->data) {
+        c->lower = NULL;
+        free(c->bucket);
+        free(c->block);
+        free(c->chain);
+        free(c->prev);
+        free(c->next);
+        free(c->data);
+        free(c);
+        return NULL;
+    }
+    for (int b = 0; b < c->nbuckets; b++) c->bucket[b] = -1;
+    c->head = c->tail = -1;
+    for (int f = 0; f < nframes; f++) {
+        c->block[f] = -1;
+        lru_push_front(c, f);
+    }
+    c->nframes = nframes;
+    c->lower = lower;
+    c->dev.ops = &cache_ops;
+    c->dev.fd = lower->fd;
+    c->dev.map = NULL;
+    c->dev.map_blocks = 0;
+    return &c->dev;
+}
+
+/**
+ * Copy the counters of a cache device. Returns -1 if dev is not a cache.
+ */
+int blkdev_cache_stats(BlockDevice *dev, BlockCacheStats *stats) {
+    if (!dev || dev->ops != &cache_ops) return -1;
+    BlockCache *c = (BlockCache *)dev;
+    *stats = c->stats;
+    stats->frames = c->nframes;
+    return 0;
+}
@@ -0,0 +1,672 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "blkdev.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#define IOV_BATCH 64     // iovecs handed to one preadv/pwritev
+#define BOUNCE_BLOCKS 32
+
+static const uint8_t zero_block[BLOCK_SIZE] = {0};
+
+/**
+ * Transfer a contiguous run of the disk file starting at off to or from the buffers in iov, with one
+ * preadv/pwritev per IOV_BATCH buffers. Short transfers and interrupts are resumed where they stopped.
+ * Reading past the end of the disk file is an error.
+ */
+static int rw_full(int fd, const struct iovec *iov, int iovcnt, off_t off, int write) {
+    struct iovec local[IOV_BATCH];
+    while (iovcnt > 0) {
+        int cnt = iovcnt < IOV_BATCH ? iovcnt : IOV_BATCH;
+        memcpy(local, iov, cnt * sizeof(struct iovec));
+        struct iovec *v = local;
+        int left = cnt;
+        while (left > 0) {
+            ssize_t n = write ? pwritev(fd, v, left, off) : preadv(fd, v, left, off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+            off += n;
+            while (left > 0 && (size_t)n >= v->iov_len) {
+                n -= v->iov_len;
+                v++;
+                left--;
+            }
+            if (left > 0) {
+                v->iov_base = (uint8_t *)v->iov_base + n;
+                v->iov_len -= n;
+            }
+        }
+        iov += cnt;
+        iovcnt -= cnt;
+    }
+    return 0;
+}
+
+static int pread_full(int fd, void *buf, size_t len, off_t off) {
+    struct iovec iov = {buf, len};
+    return rw_full(fd, &iov, 1, off, 0);
+}
+
+static int pwrite_full(int fd, const void *buf, size_t len, off_t off) {
+    struct iovec iov = {(void *)buf, len};
+    return rw_full(fd, &iov, 1, off, 1);
+}
+
+/**
+ * Write count zero blocks at block with vectored writes that all point at the same zero block.
+ */
+static int pwrite_zeroes(int fd, int block, int count) {
+    struct iovec iov[IOV_BATCH];
+    for (int i = 0; i < IOV_BATCH; i++) {
+        iov[i].iov_base = (void *)zero_block;
+        iov[i].iov_len = BLOCK_SIZE;
+    }
+    while (count > 0) {
+        int n = count < IOV_BATCH ? count : IOV_BATCH;
+        if (rw_full(fd, iov, n, (off_t)block * BLOCK_SIZE, 1) < 0) return -1;
+        block += n;
+        count -= n;
+    }
+    return 0;
+}
+
+/**
+ * Find the blocks of a move's source range that its destination does not cover. Both ranges have the same
+ * length, so what is left over is a single run at one end of the source.
+ */
+static void move_remainder(const BlockMove *m, int *start, int *count) {
+    if (m->dst + m->count <= m->src || m->dst >= m->src + m->count) {
+        *start = m->src;
+        *count = m->count;
+    } else if (m->dst < m->src) {
+        *start = m->dst + m->count;
+        *count = m->src - m->dst;
+    } else {
+        *start = m->src;
+        *count = m->dst - m->src;
+    }
+}
+
+/**
+ * Copy count blocks from src to dst through a bounded stack buffer. When the destination lies above an
+ * overlapping source the chunks are copied from the end of the range backwards, like memmove.
+ */
+static int bounce_copy(BlockDevice *dev, int src, int dst, int count) {
+    uint8_t bounce[BOUNCE_BLOCKS * BLOCK_SIZE];
+    int backward = dst > src;
+    for (int done = 0; done < count;) {
+        int n = count - done < BOUNCE_BLOCKS ? count - done : BOUNCE_BLOCKS;
+        int off = backward ? count - done - n : done;
+        if (dev->ops->read_blocks(dev, src + off, n, bounce) < 0) return -1;
+        if (dev->ops->write_blocks(dev, dst + off, n, bounce) < 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+/**
+ * Zero the source blocks of a completed move that its destination does not cover.
+ */
+static int zero_move_remainder(BlockDevice *dev, const BlockMove *m) {
+    int rest_start, rest_count;
+    move_remainder(m, &rest_start, &rest_count);
+    if (rest_count <= 0) return 0;
+    return dev->ops->zero_blocks(dev, rest_start, rest_count);
+}
+
+/**
+ * Relocate blocks one move at a time with the device's own read, write and zero operations.
+ */
+static int generic_move_blocks(BlockDevice *dev, const BlockMove *moves, int n) {
+    for (int i = 0; i < n; i++) {
+        const BlockMove *m = &moves[i];
+        if (m->count <= 0 || m->src == m->dst) continue;
+        if (bounce_copy(dev, m->src, m->dst, m->count) < 0) return -1;
+        if (zero_move_remainder(dev, m) < 0) return -1;
+    }
+    return 0;
+}
+
+static int pio_read_blocks(BlockDevice *dev, int block, int count, void *buf) {
+    return pread_full(dev->fd, buf, (size_t)count * BLOCK_SIZE, (off_t)block * BLOCK_SIZE);
+}
+
+static int pio_write_blocks(BlockDevice *dev, int block, int count, const void *buf) {
+    return pwrite_full(dev->fd, buf, (size_t)count * BLOCK_SIZE, (off_t)block * BLOCK_SIZE);
+}
+
+static int pio_readv_blocks(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt) {
+    return rw_full(dev->fd, iov, iovcnt, (off_t)block * BLOCK_SIZE, 0);
+}
+
+static int pio_writev_blocks(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt) {
+    return rw_full(dev->fd, iov, iovcnt, (off_t)block * BLOCK_SIZE, 1);
+}
+
+/**
+ * Zero a run of blocks in the disk file with a single fallocate, preferring to punch a hole so the image stays
+ * sparse. Modes the host file system rejects are remembered and not tried again. Returns -1 when no mode is
+ * supported and the caller has to write zeroes itself.
+ */
+static int fallocate_zero(BlockDevice *dev, int block, int count) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+    static const int modes[] = {
+        FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+        FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+    };
+    while (dev->zero_fallback < 2) {
+        if (fallocate(dev->fd, modes[dev->zero_fallback], (off_t)block * BLOCK_SIZE, (off_t)count * BLOCK_SIZE) == 0) {
+            return 0;
+        }
+        if (errno != EOPNOTSUPP && errno != ENOSYS && errno != EINVAL) return -1;
+        dev->zero_fallback++;
+    }
+#endif
+    return -1;
+}
+
+static int pio_zero_blocks(BlockDevice *dev, int block, int count) {
+    if (fallocate_zero(dev, block, count) == 0) return 0;
+    return pwrite_zeroes(dev->fd, block, count);
+}
+
+/**
+ * Copy count blocks from src to dst inside the disk file with copy_file_range, so the data never passes through
+ * user space. The ranges must not overlap.
+ */
+static int copy_range(BlockDevice *dev, int src, int dst, int count) {
+    loff_t src_off = (loff_t)src * BLOCK_SIZE, dst_off = (loff_t)dst * BLOCK_SIZE;
+    size_t len = (size_t)count * BLOCK_SIZE;
+    while (len > 0) {
+        ssize_t n = copy_file_range(dev->fd, &src_off, dev->fd, &dst_off, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Relocate blocks in the kernel with copy_file_range. Overlapping moves, and every move once the host has
+ * refused copy_file_range, go through a bounded bounce buffer instead.
+ */
+static int pio_move_blocks(BlockDevice *dev, const BlockMove *moves, int n) {
+    for (int i = 0; i < n; i++) {
+        const BlockMove *m = &moves[i];
+        if (m->count <= 0 || m->src == m->dst) continue;
+        int overlap = m->dst < m->src + m->count && m->src < m->dst + m->count;
+        int copied = 0;
+        if (!overlap && !dev->no_copy_range) {
+            copied = copy_range(dev, m->src, m->dst, m->count) == 0;
+            // A partial copy is simply redone below, the source has not been touched yet
+            if (!copied && errno != EIO) dev->no_copy_range = 1;
+        }
+        if (!copied && bounce_copy(dev, m->src, m->dst, m->count) < 0) return -1;
+        if (zero_move_remainder(dev, m) < 0) return -1;
+    }
+    return 0;
+}
+
+static int pio_flush(BlockDevice *dev) {
+    return fdatasync(dev->fd);
+}
+
+static void pio_close(BlockDevice *dev) {
+    close(dev->fd);
+    free(dev);
+}
+
+static const BlockDeviceOps pio_ops = {
+    .read_blocks = pio_read_blocks,
+    .write_blocks = pio_write_blocks,
+    .readv_blocks = pio_readv_blocks,
+    .writev_blocks = pio_writev_blocks,
+    .zero_blocks = pio_zero_blocks,
+    .flush = pio_flush,
+    .close = pio_close,
+    .move_blocks = pio_move_blocks,
+};
+
+/**
+ * Wrap an open virtual disk file in a device that transfers blocks with positional pread/pwrite,
+ * one system call per contiguous run of blocks. The device takes ownership of fd.
+ */
+BlockDevice *blkdev_open_pio(int fd) {
+    BlockDevice *dev = malloc(sizeof(BlockDevice));
+    if (!dev) return NULL;
+    dev->ops = &pio_ops;
+    dev->fd = fd;
+    dev->map = NULL;
+    dev->map_blocks = 0;
+    dev->zero_fallback = 0;
+    dev->no_copy_range = 0;
+    return dev;
+}
+
+static int mmap_in_range(BlockDevice *dev, int block, int count) {
+    return block >= 0 && block + count <= dev->map_blocks;
+}
+
+static int mmap_read_blocks(BlockDevice *dev, int block, int count, void *buf) {
+    if (!mmap_in_range(dev, block, count)) return -1;
+    memcpy(buf, (uint8_t *)dev->map + (size_t)block * BLOCK_SIZE, (size_t)count * BLOCK_SIZE);
+    return 0;
+}
+
+static int mmap_write_blocks(BlockDevice *dev, int block, int count, const void *buf) {
+    if (!mmap_in_range(dev, block, count)) return -1;
+    uint8_t *dst = (uint8_t *)dev->map + (size_t)block * BLOCK_SIZE;
+    // Callers may hand back a pointer into the mapping itself
+    if (dst != buf) memmove(dst, buf, (size_t)count * BLOCK_SIZE);
+    return 0;
+}
+
+static int mmap_readv_blocks(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; i++) {
+        int count = iov[i].iov_len / BLOCK_SIZE;
+        if (mmap_read_blocks(dev, block, count, iov[i].iov_base) < 0) return -1;
+        block += count;
+    }
+    return 0;
+}
+
+static int mmap_writev_blocks(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; i++) {
+        int count = iov[i].iov_len / BLOCK_SIZE;
+        if (mmap_write_blocks(dev, block, count, iov[i].iov_base) < 0) return -1;
+        block += count;
+    }
+    return 0;
+}
+
+static int mmap_zero_blocks(BlockDevice *dev, int block, int count) {
+    if (!mmap_in_range(dev, block, count)) return -1;
+    // A punched hole reads back as zeroes through the mapping too
+    if (fallocate_zero(dev, block, count) == 0) return 0;
+    memset((uint8_t *)dev->map + (size_t)block * BLOCK_SIZE, 0, (size_t)count * BLOCK_SIZE);
+    return 0;
+}
+
+static int mmap_move_blocks(BlockDevice *dev, const BlockMove *moves, int n) {
+    for (int i = 0; i < n; i++) {
+        const BlockMove *m = &moves[i];
+        if (m->count <= 0 || m->src == m->dst) continue;
+        if (!mmap_in_range(dev, m->src, m->count) || !mmap_in_range(dev, m->dst, m->count)) return -1;
+        uint8_t *base = dev->map;
+        memmove(base + (size_t)m->dst * BLOCK_SIZE, base + (size_t)m->src * BLOCK_SIZE, (size_t)m->count * BLOCK_SIZE);
+        if (zero_move_remainder(dev, m) < 0) return -1;
+    }
+    return 0;
+}
+
+static int mmap_flush(BlockDevice *dev) {
+    return msync(dev->map, (size_t)dev->map_blocks * BLOCK_SIZE, MS_SYNC);
+}
+
+static void mmap_close(BlockDevice *dev) {
+    msync(dev->map, (size_t)dev->map_blocks * BLOCK_SIZE, MS_SYNC);
+    munmap(dev->map, (size_t)dev->map_blocks * BLOCK_SIZE);
+    close(dev->fd);
+    free(dev);
+}
+
+static const BlockDeviceOps mmap_ops = {
+    .read_blocks = mmap_read_blocks,
+    .write_blocks = mmap_write_blocks,
+    .readv_blocks = mmap_readv_blocks,
+    .writev_blocks = mmap_writev_blocks,
+    .zero_blocks = mmap_zero_blocks,
+    .flush = mmap_flush,
+    .close = mmap_close,
+    .move_blocks = mmap_move_blocks,
+};
+
+/**
+ * Map the first nblocks blocks of an open virtual disk file MAP_SHARED, so that block transfers are plain memory
+ * copies and changes reach the file through the page cache. Returns NULL without taking ownership of fd if the
+ * file is shorter than nblocks blocks or cannot be mapped; otherwise the device owns fd.
+ */
+BlockDevice *blkdev_open_mmap(int fd, int nblocks) {
+    struct stat st;
+    size_t len = (size_t)nblocks * BLOCK_SIZE;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)len) return NULL;
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return NULL;
+    BlockDevice *dev = malloc(sizeof(BlockDevice));
+    if (!dev) {
+        munmap(map, len);
+        return NULL;
+    }
+    dev->ops = &mmap_ops;
+    dev->fd = fd;
+    dev->map = map;
+    dev->map_blocks = nblocks;
+    dev->zero_fallback = 0;
+    dev->no_copy_range = 0;
+    return dev;
+}
+
+#ifdef HAVE_IO_URING
+
+#define URING_ENTRIES 64
+
+typedef struct {
+    BlockDevice dev;
+    int ring_fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    int broken; // io_uring_enter failed to submit, entries may still sit in the ring
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_len, cq_ring_len;
+} UringDevice;
+
+/**
+ * Fill the i-th next submission queue entry with a transfer at block. len is the byte count for plain reads and
+ * writes and the iovec count for vectored ones; bytes is the size of a complete transfer.
+ */
+static void uring_prep(UringDevice *u, unsigned i, int op, int block, const void *addr, unsigned len, size_t bytes) {
+    unsigned tail = *u->sq_tail + i;
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = u->dev.fd;
+    sqe->off = (uint64_t)block * BLOCK_SIZE;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = bytes;
+    u->sq_array[idx] = idx;
+}
+
+/**
+ * Submit n prepared entries as one linked chain and wait for all of them in a single io_uring_enter.
+ * Returns the number of entries that completed with a full transfer before the first failure.
+ *
+ * If io_uring_enter fails, no more entries are submitted and the ring is marked broken, but the entries the kernel
+ * already took are still waited for, since they use the caller's buffers. *pending is set to the number of those
+ * that could not be waited for, in which case the buffers must not be freed.
+ */
+static unsigned uring_run(UringDevice *u, unsigned n, unsigned *pending) {
+    u->sqes[(*u->sq_tail + n - 1) & *u->sq_mask].flags &= ~IOSQE_IO_LINK;
+    __atomic_store_n(u->sq_tail, *u->sq_tail + n, __ATOMIC_RELEASE);
+
+    unsigned submitted = 0, reaped = 0, ok = 0;
+    int failed = 0;
+    *pending = 0;
+    while (reaped < (u->broken ? submitted : n)) {
+        unsigned to_submit = u->broken ? 0 : n - submitted;
+        unsigned to_wait = (u->broken ? submitted : n) - reaped;
+        int ret = syscall(__NR_io_uring_enter, u->ring_fd, to_submit, to_wait, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            if (to_submit == 0) {
+                // Waiting itself failed: the kernel may still be using the buffers
+                *pending = submitted - reaped;
+                break;
+            }
+            u->broken = 1;
+            continue;
+        }
+        submitted += (unsigned)ret < to_submit ? (unsigned)ret : to_submit;
+        unsigned head = *u->cq_head;
+        unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+            if (cqe->res < 0 || (uint64_t)cqe->res != cqe->user_data) failed = 1;
+            if (!failed) ok++;
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return ok;
+}
+
+/**
+ * Queue each relocation as a linked read, write and zeroing of the uncovered source blocks and submit as many
+ * relocations per io_uring_enter as the ring holds. The chain keeps the moves in order, so a move may overwrite
+ * blocks that an earlier move vacated. If the ring rejects a batch before anything was written, the remaining
+ * moves are done synchronously.
+ */
+static int uring_move_blocks(BlockDevice *dev, const BlockMove *moves, int n) {
+    UringDevice *u = (UringDevice *)dev;
+    if (u->broken) return generic_move_blocks(dev, moves, n);
+    int next = 0;
+    while (next < n) {
+        int first = next, staged = 0, max_zero = 0;
+        unsigned entries = 0;
+        while (next < n && entries + 3 <= u->sq_entries) {
+            int rest_start, rest_count;
+            move_remainder(&moves[next], &rest_start, &rest_count);
+            if (moves[next].count > 0 && moves[next].src != moves[next].dst) {
+                staged += moves[next].count;
+                if (rest_count > max_zero) max_zero = rest_count;
+                entries += 2 + (rest_count > 0);
+            }
+            next++;
+        }
+        if (entries == 0) continue;
+
+        uint8_t *stage = malloc((size_t)staged * BLOCK_SIZE);
+        // Every zero write points all of its iovecs at the same zero block
+        struct iovec *zero_iov = malloc((max_zero > 0 ? max_zero : 1) * sizeof(struct iovec));
+        if (!stage || !zero_iov) {
+            free(stage);
+            free(zero_iov);
+            return -1;
+        }
+        for (int z = 0; z < max_zero; z++) {
+            zero_iov[z].iov_base = (void *)zero_block;
+            zero_iov[z].iov_len = BLOCK_SIZE;
+        }
+        unsigned i = 0;
+        uint8_t *p = stage;
+        for (int m = first; m < next; m++) {
+            const BlockMove *mv = &moves[m];
+            if (mv->count <= 0 || mv->src == mv->dst) continue;
+            int rest_start, rest_count;
+            move_remainder(mv, &rest_start, &rest_count);
+            size_t len = (size_t)mv->count * BLOCK_SIZE;
+            uring_prep(u, i++, IORING_OP_READ, mv->src, p, len, len);
+            uring_prep(u, i++, IORING_OP_WRITE, mv->dst, p, len, len);
+            if (rest_count > 0) {
+                uring_prep(u, i++, IORING_OP_WRITEV, rest_start, zero_iov, rest_count, (size_t)rest_count * BLOCK_SIZE);
+            }
+            p += len;
+        }
+        unsigned pending;
+        unsigned ok = uring_run(u, entries, &pending);
+        // Buffers of entries still in flight are leaked rather than handed back while the kernel may use them
+        if (pending) return -1;
+        free(stage);
+        free(zero_iov);
+        if (ok < entries) {
+            // The first entry is a read, so if it failed nothing has been written and the batch can be redone
+            if (ok == 0) return generic_move_blocks(dev, moves + first, n - first);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int uring_read_blocks(BlockDevice *dev, int block, int count, void *buf) {
+    return pread_full(dev->fd, buf, (size_t)count * BLOCK_SIZE, (off_t)block * BLOCK_SIZE);
+}
+
+static void uring_close(BlockDevice *dev) {
+    UringDevice *u = (UringDevice *)dev;
+    munmap(u->sqes, u->sq_entries * sizeof(struct io_uring_sqe));
+    if (u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_len);
+    munmap(u->sq_ring, u->sq_ring_len);
+    close(u->ring_fd);
+    close(dev->fd);
+    free(u);
+}
+
+// Single transfers gain nothing from a ring round trip and go through pread/pwrite
+static const BlockDeviceOps uring_ops = {
+    .read_blocks = uring_read_blocks,
+    .write_blocks = pio_write_blocks,
+    .readv_blocks = pio_readv_blocks,
+    .writev_blocks = pio_writev_blocks,
+    .zero_blocks = pio_zero_blocks,
+    .flush = pio_flush,
+    .close = uring_close,
+    .move_blocks = uring_move_blocks,
+};
+
+/**
+ * Wrap an open virtual disk file in a device that batches relocations through an io_uring. Returns NULL without
+ * taking ownership of fd if the kernel does not provide io_uring; otherwise the device owns fd.
+ */
+BlockDevice *blkdev_open_uring(int fd) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring_fd < 0) return NULL;
+
+    UringDevice *u = calloc(1, sizeof(UringDevice));
+    if (!u) {
+        close(ring_fd);
+        return NULL;
+    }
+    u->ring_fd = ring_fd;
+    u->sq_entries = params.sq_entries;
+    u->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    u->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_len > u->sq_ring_len) u->sq_ring_len = u->cq_ring_len;
+        u->cq_ring_len = u->sq_ring_len;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                      IORING_OFF_SQ_RING);
+    u->cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? u->sq_ring :
+                 mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                      IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        if (u->sqes != MAP_FAILED) munmap(u->sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+        if (u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_len);
+        if (u->sq_ring != MAP_FAILED) munmap(u->sq_ring, u->sq_ring_len);
+        close(ring_fd);
+        free(u);
+        return NULL;
+    }
+    uint8_t *sq = u->sq_ring, *cq = u->cq_ring;
+    u->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + params.sq_off.array);
+    u->cq_head = (unsigned *)(cq + params.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    u->dev.ops = &uring_ops;
+    u->dev.fd = fd;
+    u->dev.map = NULL;
+    u->dev.map_blocks = 0;
+    u->dev.zero_fallback = 0;
+    u->dev.no_copy_range = 0;
+    return &u->dev;
+}
+
+#else
+
+BlockDevice *blkdev_open_uring(int fd) {
+    return NULL;
+}
+
+#endif
+
+int blkdev_read_blocks(BlockDevice *dev, int block, int count, void *buf) {
+    if (count <= 0) return 0;
+    return dev->ops->read_blocks(dev, block, count, buf);
+}
+
+int blkdev_write_blocks(BlockDevice *dev, int block, int count, const void *buf) {
+    if (count <= 0) return 0;
+    return dev->ops->write_blocks(dev, block, count, buf);
+}
+
+int blkdev_readv_blocks(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt) {
+    if (iovcnt <= 0) return 0;
+    return dev->ops->readv_blocks(dev, block, iov, iovcnt);
+}
+
+int blkdev_writev_blocks(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt) {
+    if (iovcnt <= 0) return 0;
+    return dev->ops->writev_blocks(dev, block, iov, iovcnt);
+}
+
+int blkdev_zero_blocks(BlockDevice *dev, int block, int count) {
+    if (count <= 0) return 0;
+    return dev->ops->zero_blocks(dev, block, count);
+}
+
+static int extent_cmp(const void *a, const void *b) {
+    return ((const BlockExtent *)a)->start - ((const BlockExtent *)b)->start;
+}
+
+/**
+ * Sort a set of block extents and merge the ones that touch or overlap, in place. Returns the number of extents
+ * left.
+ */
+int blkdev_merge_extents(BlockExtent *extents, int n) {
+    qsort(extents, n, sizeof(BlockExtent), extent_cmp);
+    int merged = 0;
+    for (int i = 0; i < n;) {
+        int start = extents[i].start;
+        int end = start + extents[i].count;
+        for (i++; i < n && extents[i].start <= end; i++) {
+            if (extents[i].start + extents[i].count > end) end = extents[i].start + extents[i].count;
+        }
+        extents[merged++] = (BlockExtent){start, end - start};
+    }
+    return merged;
+}
+
+/**
+ * Zero a set of block extents, one zero operation per extent. Extents that touch should have been merged with
+ * blkdev_merge_extents first so that each contiguous run costs a single call.
+ */
+int blkdev_zero_extents(BlockDevice *dev, const BlockExtent *extents, int n) {
+    int err = 0;
+    for (int i = 0; i < n; i++) {
+        if (blkdev_zero_blocks(dev, extents[i].start, extents[i].count) < 0) err = -1;
+    }
+    return err;
+}
+
+int blkdev_move_blocks(BlockDevice *dev, const BlockMove *moves, int n) {
+    if (n <= 0) return 0;
+    if (dev->ops->move_blocks) return dev->ops->move_blocks(dev, moves, n);
+    return generic_move_blocks(dev, moves, n);
+}
+
+int blkdev_flush(BlockDevice *dev) {
+    return dev->ops->flush(dev);
+}
+
+void blkdev_close(BlockDevice *dev) {
+    if (dev) dev->ops->close(dev);
+}
@@ -0,0 +1,71 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <sys/uio.h>
+
+#define BLOCK_SIZE 1024
+
+typedef struct BlockDevice BlockDevice;
+
+// Run of count blocks starting at start
+typedef struct {
+	int start;
+	int count;
+} BlockExtent;
+
+// Relocation of count blocks from src to dst. Source blocks that the destination does not cover are zeroed.
+typedef struct {
+	int src;
+	int dst;
+	int count;
+} BlockMove;
+
+// Operations every block device backend provides. Block numbers are absolute block indices on the disk and
+// every transfer covers whole blocks: the vectored variants move one contiguous run of blocks to or from a list
+// of buffers whose lengths are multiples of BLOCK_SIZE. All operations return 0 on success and -1 on failure.
+typedef struct {
+	int (*read_blocks)(BlockDevice *dev, int block, int count, void *buf);
+	int (*write_blocks)(BlockDevice *dev, int block, int count, const void *buf);
+	int (*readv_blocks)(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt);
+	int (*writev_blocks)(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt);
+	int (*zero_blocks)(BlockDevice *dev, int block, int count);
+	int (*flush)(BlockDevice *dev);
+	void (*close)(BlockDevice *dev);
+	int (*move_blocks)(BlockDevice *dev, const BlockMove *moves, int n); // Optional, NULL uses the other ops
+} BlockDeviceOps;
+
+// Counters of a block cache device
+typedef struct {
+	unsigned long hits;      // Blocks read from a frame
+	unsigned long misses;    // Blocks read from the device below
+	unsigned long evictions; // Frames reused for another block
+	int frames;              // Capacity in blocks
+} BlockCacheStats;
+
+struct BlockDevice {
+	const BlockDeviceOps *ops; // Backend implementation
+	int fd;                    // Virtual disk file, owned by the device
+	void *map;                 // Whole disk mapped into memory, NULL if the backend does not map it
+	int map_blocks;            // Number of blocks covered by map
+	int zero_fallback;         // fallocate modes found unsupported: 0 none, 1 hole punching, 2 all
+	int no_copy_range;         // copy_file_range is unavailable, relocations use a bounce buffer
+};
+
+BlockDevice *blkdev_open_pio(int fd);
+BlockDevice *blkdev_open_mmap(int fd, int nblocks);
+BlockDevice *blkdev_open_uring(int fd);
+BlockDevice *blkdev_open_cache(BlockDevice *lower, int nframes);
+int blkdev_cache_stats(BlockDevice *dev, BlockCacheStats *stats);
+
+int blkdev_read_blocks(BlockDevice *dev, int block, int count, void *buf);
+int blkdev_write_blocks(BlockDevice *dev, int block, int count, const void *buf);
+int blkdev_readv_blocks(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt);
+int blkdev_writev_blocks(BlockDevice *dev, int block, const struct iovec *iov, int iovcnt);
+int blkdev_zero_blocks(BlockDevice *dev, int block, int count);
+int blkdev_merge_extents(BlockExtent *extents, int n);
+int blkdev_zero_extents(BlockDevice *dev, const BlockExtent *extents, int n);
+int blkdev_move_blocks(BlockDevice *dev, const BlockMove *moves, int n);
+int blkdev_flush(BlockDevice *dev);
+void blkdev_close(BlockDevice *dev);
+
+#endif
@@ -0,0 +1,240 @@
+#include <string.h>
+#include <pthread.h>
+#include "check.h"
+#include "bitmap.h"
+#include "inodescan.h"
+
+/**
+ * Consistency checks of fs_mount, fused into one pass over the inode table and one pass over the free block list.
+ *
+ * Every inode is tested against checks 1 to 4 as it is visited, its (parent, name) pair goes into a hash set that
+ * catches duplicates for check 5, and the blocks of every valid file are added to two block bitmaps, blocks owned by
+ * at least one file and blocks owned by more than one. Check 6 then compares those with the free block list a 64-bit
+ * word at a time. Each check only looks at one inode, or at one inode and its parent, so reporting the lowest check
+ * that failed anywhere gives the same answer as running the six checks one after the other.
+ *
+ * The inode pass can be split into contiguous shards checked by separate threads. Each shard produces the lowest
+ * check it saw fail, its own name set and its own block bitmaps; the shards are then folded together in index order,
+ * a name found in two shards failing check 5 and a block owned in two shards becoming shared. None of the partial
+ * results depend on timing, so the error code is the same for any number of threads.
+ */
+
+#define NAME_SET_FULL (1ull << 63) // Marks an occupied slot, keys only use the low 47 bits
+
+/**
+ * Find the slot of a (parent, name) key in the set, adding the key if it is not there yet. found is set to 1 if it was.
+ */
+static int name_set_slot(uint64_t *set, uint64_t key, int *found) {
+    key |= NAME_SET_FULL;
+    int s = (key * 0x9E3779B97F4A7C15ull) >> 56; // Top 8 bits, NAME_SET_SLOTS == 256
+    for (; set[s]; s = (s + 1) % NAME_SET_SLOTS) {
+        if (set[s] == key) {
+            *found = 1;
+            return s;
+        }
+    }
+    set[s] = key;
+    *found = 0;
+    return s;
+}
+
+/**
+ * Add a (parent, name) key to the set. Returns 1 if it was already there.
+ */
+int name_set_add(uint64_t *set, uint64_t key) {
+    int found;
+    name_set_slot(set, key, &found);
+    return found;
+}
+
+/**
+ * Key of the (parent, name) pair of inode i, for a name set.
+ */
+uint64_t name_set_key(const InodeTable *t, int i) {
+    return (uint64_t)t->parent[i] << 40 | inode_name_canonical(t->name[i]);
+}
+
+/**
+ * Run checks 1 to 4 on inode i. Returns a mask with CHECK_BIT(c) set for every check c the inode fails, 0 if it
+ * passes them all.
+ *
+ * A free inode only takes check 1, which a free directory inode already fails before check 3. An inode in use takes
+ * check 2 or 3 depending on its type, and check 4 whatever the outcome of those.
+ */
+int check_inode(const InodeTable *t, int i) {
+    if (!t->used[i]) {
+        return (t->name[i] | t->size[i] | t->start[i] | t->is_dir[i] | t->parent[i]) ? CHECK_BIT(1) : 0;
+    }
+    int failed = 0;
+    if (!t->is_dir[i]) {
+        int start = t->start[i], end = t->start[i] + t->size[i];
+        if (start < 1 || start > 127 || end - 1 > 127) failed |= CHECK_BIT(2);
+    } else if (t->start[i] != 0 || t->size[i] != 0) {
+        failed |= CHECK_BIT(3);
+    }
+    int parent = t->parent[i];
+    if (parent == 126 || (parent <= 125 && (!t->used[parent] || !t->is_dir[parent]))) failed |= CHECK_BIT(4);
+    return failed;
+}
+
+// Partial result of checking inodes first to last - 1
+typedef struct {
+    const InodeTable *t;
+    int first, last;
+    int error;                          // Lowest check that failed in the shard, 0 if none
+    uint64_t names[NAME_SET_SLOTS];     // (parent, name) keys of the inodes that passed checks 1 to 4
+    uint64_t owned[CHECK_BLOCKS / 64];  // Blocks of at least one valid file
+    uint64_t shared[CHECK_BLOCKS / 64]; // Blocks of more than one valid file
+} CheckShard;
+
+static void *check_shard(void *arg) {
+    CheckShard *c = arg;
+    const InodeTable *t = c->t;
+    memset(c->names, 0, sizeof(c->names));
+    memset(c->owned, 0, sizeof(c->owned));
+    memset(c->shared, 0, sizeof(c->shared));
+    c->error = 0;
+
+    for (int i = c->first; i < c->last; i++) {
+        int failed = check_inode(t, i);
+        if (t->used[i] && !t->is_dir[i] && !(failed & CHECK_BIT(2))) {
+            int start = t->start[i], end = t->start[i] + t->size[i];
+            for (int w = start / 64; 64 * w < end; w++) {
+                int a = (start > 64 * w) ? start - 64 * w : 0;
+                int b = (end < 64 * w + 64) ? end - 64 * w : 64;
+                uint64_t m = bitmap_word_mask(a, b);
+                c->shared[w] |= c->owned[w] & m;
+                c->owned[w] |= m;
+            }
+        }
+        // Check 5, unless this inode already failed a lower one
+        if (t->used[i] && !failed &&
+            name_set_add(c->names, name_set_key(t, i))) {
+            failed = CHECK_BIT(5);
+        }
+        if (failed) {
+            int lowest = __builtin_ctz(failed);
+            if (!c->error || lowest < c->error) c->error = lowest;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Fold shard s into the running result in into.
+ */
+static void check_merge(CheckShard *into, const CheckShard *s) {
+    if (s->error && (!into->error || s->error < into->error)) into->error = s->error;
+    for (int k = 0; k < NAME_SET_SLOTS; k++) {
+        if (s->names[k] && name_set_add(into->names, s->names[k]) && (!into->error || into->error > 5)) {
+            into->error = 5;
+        }
+    }
+    for (int w = 0; w < CHECK_BLOCKS / 64; w++) {
+        into->shared[w] |= s->shared[w] | (into->owned[w] & s->owned[w]);
+        into->owned[w] |= s->owned[w];
+    }
+}
+
+/**
+ * Check the superblock sb, whose inode table has been decoded into t.
+ *
+ * Returns the number of the first of checks 1 to 5 that fails, or 0 if they all pass. Check 6 does not stop a mount:
+ * the blocks that violate it are set in bad_blocks, in the bit order of the free block list. A bad block marked used
+ * in the free block list does not belong to exactly one file (error code 6), a bad block marked free belongs to one
+ * (error code 5). Block 0 holds the superblock and is never reported.
+ *
+ * The inode table is split over threads shards (1 to CHECK_MAX_THREADS), all but the first checked on their own thread.
+ */
+int check_image(const Superblock *sb, const InodeTable *t, uint8_t bad_blocks[CHECK_BLOCKS / 8], int threads) {
+    CheckShard shards[CHECK_MAX_THREADS];
+    pthread_t tid[CHECK_MAX_THREADS];
+    int started[CHECK_MAX_THREADS] = {0};
+    if (threads < 1) threads = 1;
+    if (threads > CHECK_MAX_THREADS) threads = CHECK_MAX_THREADS;
+
+    // Shard 0 runs on the calling thread; a shard whose thread cannot be started runs there too
+    for (int s = 0; s < threads; s++) {
+        shards[s].t = t;
+        shards[s].first = INODE_COUNT * s / threads;
+        shards[s].last = INODE_COUNT * (s + 1) / threads;
+        if (s > 0) started[s] = (pthread_create(&tid[s], NULL, check_shard, &shards[s]) == 0);
+    }
+    for (int s = 0; s < threads; s++) {
+        if (!started[s]) check_shard(&shards[s]);
+    }
+    for (int s = 1; s < threads; s++) {
+        if (started[s]) pthread_join(tid[s], NULL);
+        check_merge(&shards[0], &shards[s]);
+    }
+    const uint64_t *owned = shards[0].owned, *shared = shards[0].shared;
+
+    // Check 6
+    const uint8_t *free_list = (const uint8_t *)sb->free_block_list;
+    for (int w = 0; w < CHECK_BLOCKS / 64; w++) {
+        uint64_t used = bitmap_load_word(free_list, CHECK_BLOCKS, w);
+        uint64_t once = owned[w] & ~shared[w];
+        uint64_t bad = (used & ~once) | (~used & owned[w]);
+        if (w == 0) bad &= ~bitmap_word_mask(0, 1);
+        bitmap_store_word(bad_blocks, CHECK_BLOCKS, w, bad);
+    }
+    return shards[0].error;
+}
+
+/**
+ * List every violation of checks 1 to 6 in sb, whose inode table has been decoded into t, in one pass. out must have
+ * room for CHECK_MAX_VIOLATIONS entries. Returns the number of violations.
+ *
+ * An inode is reported once for every check it fails, in the order of the checks, and the inodes come in index
+ * order followed by the blocks that fail check 6. As in check_image, only inodes that pass checks 1 to 4 take part in
+ * check 5, where the first inode with a name is kept and every later one is reported, and only files that pass check
+ * 2 own blocks for check 6.
+ */
+int check_all(const Superblock *sb, const InodeTable *t, CheckViolation *out) {
+    uint64_t names[NAME_SET_SLOTS] = {0};
+    uint8_t first_with_name[NAME_SET_SLOTS];
+    uint8_t owners[CHECK_BLOCKS] = {0}, first_owner[CHECK_BLOCKS];
+    int n = 0;
+
+    // A free inode with every bit zero passes checks 1 to 4 and owns no blocks, so only the other inodes are visited.
+    // The scan kernel finds every empty inode of the packed table in sb at once.
+    uint64_t words[INODE_COUNT], empty[(INODE_COUNT + 63) / 64];
+    memcpy(words, sb->inode, sizeof(words));
+    scan_match(words, INODE_COUNT, 0, ~0ull, empty);
+
+    for (int w = 0; w < (INODE_COUNT + 63) / 64; w++) {
+        uint64_t live = ~empty[w];
+        if (64 * w + 64 > INODE_COUNT) live &= (1ull << (INODE_COUNT - 64 * w)) - 1;
+        for (; live; live &= live - 1) {
+            int i = 64 * w + __builtin_ctzll(live);
+            int failed = check_inode(t, i);
+            for (int c = 1; c <= 4; c++) {
+                if (failed & CHECK_BIT(c)) out[n++] = (CheckViolation){c, i, -1, -1};
+            }
+            if (!t->used[i]) continue;
+            if (!t->is_dir[i] && !(failed & CHECK_BIT(2))) {
+                for (int b = t->start[i]; b < t->start[i] + t->size[i]; b++) {
+                    if (owners[b]++ == 0) first_owner[b] = i;
+                }
+            }
+            if (!failed) {
+                int found;
+                int s = name_set_slot(names, name_set_key(t, i), &found);
+                if (found) {
+                    out[n++] = (CheckViolation){5, i, -1, first_with_name[s]};
+                } else {
+                    first_with_name[s] = i;
+                }
+            }
+        }
+    }
+
+    const uint8_t *free_list = (const uint8_t *)sb->free_block_list;
+    for (int b = 1; b < CHECK_BLOCKS; b++) {
+        int used = bitmap_test(free_list, b);
+        if ((used && owners[b] != 1) || (!used && owners[b] > 0)) {
+            out[n++] = (CheckViolation){6, owners[b] ? first_owner[b] : -1, b, owners[b]};
+        }
+    }
+    return n;
+}
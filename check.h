@@ -0,0 +1,30 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdint.h>
+#include "fs-sim.h"
+#include "inodetab.h"
+
+#define CHECK_BLOCKS 128     // Blocks covered by the free block list
+#define CHECK_MAX_THREADS 16 // Most shards check_image splits the inode table into
+
+#define NAME_SET_SLOTS 256      // Slots of a (parent, name) set, a zeroed array of uint64_t
+#define CHECK_BIT(c) (1 << (c)) // Bit of check c in the mask returned by check_inode
+
+#define CHECK_MAX_VIOLATIONS (3 * INODE_COUNT + CHECK_BLOCKS) // Checks 2 or 3, 4 and 5 per inode, 6 per block
+
+// One failed check found by check_all
+typedef struct {
+	int check; // 1 to 6
+	int inode; // Inode that fails the check; for check 6 the first file owning the block, -1 if there is none
+	int block; // Block that fails check 6, -1 for checks 1 to 5
+	int other; // Check 5: the first inode with the same name. Check 6: number of files owning the block
+} CheckViolation;
+
+uint64_t name_set_key(const InodeTable *t, int i);
+int name_set_add(uint64_t *set, uint64_t key);
+int check_inode(const InodeTable *t, int i);
+int check_image(const Superblock *sb, const InodeTable *t, uint8_t bad_blocks[CHECK_BLOCKS / 8], int threads);
+int check_all(const Superblock *sb, const InodeTable *t, CheckViolation *out);
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "check.h"
+#include "bitmap.h"
+
+/**
+ * Benchmark of the mount consistency checks against the number of threads.
+ *
+ * Usage: checkbench [images] [rounds]
+ *
+ * Generates images with every inode in use (a random directory tree with files over all 127 data blocks), then times
+ * check_image on each of them for 1, 2, 4, 8 and 16 threads. A copy of every image with one random byte changed is
+ * checked as well, and its error code must not depend on the number of threads.
+ */
+
+#define BENCH_THREADS 5
+
+static const int bench_threads[BENCH_THREADS] = {1, 2, 4, 8, 16};
+
+/**
+ * Fill sb with a consistent image that uses all INODE_COUNT inodes.
+ */
+static void generate_image(Superblock *sb) {
+    InodeTable t;
+    memset(&t, 0, sizeof(t));
+    int dirs[INODE_COUNT], ndirs = 0, next_block = 1;
+    for (int i = 0; i < INODE_COUNT; i++) {
+        char name[6];
+        snprintf(name, sizeof(name), "n%d", i);
+        t.used[i] = 1;
+        t.name[i] = inode_name_pack(name);
+        t.parent[i] = (ndirs == 0 || rand() % 4 == 0) ? 127 : dirs[rand() % ndirs];
+        if (rand() % 3 == 0) {
+            t.is_dir[i] = 1;
+            dirs[ndirs++] = i;
+        } else {
+            int size = rand() % 3;
+            if (next_block + size > 128) size = 128 - next_block;
+            t.size[i] = size;
+            t.start[i] = size ? next_block : 1 + rand() % 127; // Check 2 also applies to empty files
+            next_block += size;
+        }
+    }
+    memset(sb, 0, sizeof(*sb));
+    inode_table_store(&t, sb);
+    bitmap_set_range((uint8_t *)sb->free_block_list, CHECK_BLOCKS, 0, next_block);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int images = (argc > 1) ? atoi(argv[1]) : 64;
+    int rounds = (argc > 2) ? atoi(argv[2]) : 200;
+    if (images < 1 || rounds < 1) {
+        fprintf(stderr, "Usage: %s [images] [rounds]\n", argv[0]);
+        return 1;
+    }
+    srand(1);
+
+    Superblock *sb = malloc(2 * images * sizeof(Superblock));
+    InodeTable *t = malloc(2 * images * sizeof(InodeTable));
+    for (int i = 0; i < images; i++) {
+        generate_image(&sb[i]);
+        sb[images + i] = sb[i];
+        ((uint8_t *)&sb[images + i])[rand() % sizeof(Superblock)] ^= 1 << (rand() % 8);
+    }
+    for (int i = 0; i < 2 * images; i++) inode_table_load(&t[i], &sb[i]);
+
+    int failed = 0;
+    for (int i = 0; i < 2 * images; i++) {
+        uint8_t serial_bad[CHECK_BLOCKS / 8], bad[CHECK_BLOCKS / 8];
+        int serial = check_image(&sb[i], &t[i], serial_bad, 1);
+        if (i < images && (serial || bitmap_count_set(serial_bad, CHECK_BLOCKS, 0, CHECK_BLOCKS))) {
+            fprintf(stderr, "Error: Generated image %d is inconsistent (error code: %d)\n", i, serial);
+            failed = 1;
+        }
+        for (int k = 1; k < BENCH_THREADS; k++) {
+            int error = check_image(&sb[i], &t[i], bad, bench_threads[k]);
+            if (error != serial || memcmp(bad, serial_bad, sizeof(bad))) {
+                fprintf(stderr, "Error: Image %d gives a different result with %d threads\n", i, bench_threads[k]);
+                failed = 1;
+            }
+        }
+    }
+
+    printf("%d images, %d rounds\n", images, rounds);
+    printf("threads  us/check\n");
+    for (int k = 0; k < BENCH_THREADS; k++) {
+        uint8_t bad[CHECK_BLOCKS / 8];
+        double start = now();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < images; i++) check_image(&sb[i], &t[i], bad, bench_threads[k]);
+        }
+        double us = (now() - start) * 1e6 / ((double)rounds * images);
+        printf("%7d  %8.3f\n", bench_threads[k], us);
+    }
+
+    free(sb);
+    free(t);
+    return failed;
+}
@@ -0,0 +1,87 @@
+#include <string.h>
+#include "crc32c.h"
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/**
+ * CRC32C (Castagnoli, reflected polynomial 0x82F63B78), as used by iSCSI, ext4 and btrfs.
+ *
+ * CPUs with SSE4.2 compute it with the crc32 instruction, 8 bytes per instruction. Others use slicing-by-8: eight
+ * 256-entry tables, where table k gives the CRC of a byte followed by k zero bytes, so 8 input bytes take one XOR of
+ * eight lookups. The kernel is chosen and the tables are built on the first call.
+ */
+
+#define CRC32C_POLY 0x82F63B78u
+
+typedef uint32_t (*CrcKernel)(uint32_t crc, const uint8_t *p, size_t len);
+
+static CrcKernel kernel = NULL;
+static const char *kernel_name = NULL;
+static uint32_t table[8][256];
+
+static uint32_t crc_slice8(uint32_t crc, const uint8_t *p, size_t len) {
+    for (; len >= 8; p += 8, len -= 8) {
+        crc ^= p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        crc = table[7][crc & 0xFF] ^ table[6][(crc >> 8) & 0xFF] ^ table[5][(crc >> 16) & 0xFF] ^
+              table[4][crc >> 24] ^ table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+    }
+    for (; len > 0; p++, len--) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        c = _mm_crc32_u64(c, word);
+    }
+    crc = c;
+    for (; len > 0; p++, len--) {
+        crc = _mm_crc32_u8(crc, *p);
+    }
+    return crc;
+}
+#endif
+
+static void choose_kernel(void) {
+    for (int i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c >> 1) ^ ((c & 1) ? CRC32C_POLY : 0);
+        table[0][i] = c;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int i = 0; i < 256; i++) table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+    }
+    kernel = crc_slice8;
+    kernel_name = "slicing-by-8";
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        kernel = crc_sse42;
+        kernel_name = "sse4.2";
+    }
+#endif
+}
+
+/**
+ * CRC32C of the len bytes at buf.
+ */
+uint32_t crc32c(const void *buf, size_t len) {
+    if (!kernel) choose_kernel();
+    return ~kernel(~0u, buf, len);
+}
+
+/**
+ * Name of the kernel crc32c uses on this CPU.
+ */
+const char *crc32c_kernel(void) {
+    if (!kernel) choose_kernel();
+    return kernel_name;
+}
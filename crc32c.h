@@ -0,0 +1,10 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c(const void *buf, size_t len);
+const char *crc32c_kernel(void);
+
+#endif
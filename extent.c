@@ -0,0 +1,80 @@
+#include <string.h>
+#include "extent.h"
+
+/**
+ * Index of the free runs of a disk for contiguous allocation.
+ *
+ * Marking a range costs one leaf update per block plus one pass up the tree over the parents of the range. The
+ * lowest run of at least N free blocks is found by a single walk from the root: go left while the left child holds
+ * such a run, stop if one straddles the middle, otherwise go right.
+ */
+
+static int max(int a, int b) {
+    return a > b ? a : b;
+}
+
+/**
+ * Recompute node n from its children, each of which covers half blocks.
+ */
+static void pull(FreeExtentTree *t, int n, int half) {
+    int l = 2 * n, r = 2 * n + 1;
+    t->prefix[n] = (t->prefix[l] == half) ? half + t->prefix[r] : t->prefix[l];
+    t->suffix[n] = (t->suffix[r] == half) ? half + t->suffix[l] : t->suffix[r];
+    t->longest[n] = max(max(t->longest[l], t->longest[r]), t->suffix[l] + t->prefix[r]);
+}
+
+/**
+ * Mark every block as used.
+ */
+void extent_tree_init(FreeExtentTree *t) {
+    memset(t, 0, sizeof(FreeExtentTree));
+}
+
+/**
+ * Mark count blocks starting at start as free (free != 0) or used.
+ */
+void extent_tree_set(FreeExtentTree *t, int start, int count, int free) {
+    if (count <= 0) return;
+    for (int b = start; b < start + count; b++) {
+        int leaf = EXTENT_TREE_BLOCKS + b;
+        t->prefix[leaf] = t->suffix[leaf] = t->longest[leaf] = free ? 1 : 0;
+    }
+    int lo = (EXTENT_TREE_BLOCKS + start) / 2, hi = (EXTENT_TREE_BLOCKS + start + count - 1) / 2;
+    for (int half = 1; lo >= 1; half *= 2, lo /= 2, hi /= 2) {
+        for (int n = lo; n <= hi; n++) pull(t, n, half);
+    }
+}
+
+/**
+ * Find the lowest block that starts a run of at least count free blocks. Returns -1 if there is no such run.
+ */
+int extent_tree_first_fit(const FreeExtentTree *t, int count) {
+    if (count <= 0 || t->longest[1] < count) return -1;
+    int n = 1, lo = 0;
+    for (int len = EXTENT_TREE_BLOCKS; n < EXTENT_TREE_BLOCKS; len /= 2) {
+        int half = len / 2, l = 2 * n;
+        if (t->longest[l] >= count) {
+            n = l;
+        } else if (t->suffix[l] + t->prefix[l + 1] >= count) {
+            return lo + half - t->suffix[l];
+        } else {
+            n = l + 1;
+            lo += half;
+        }
+    }
+    return lo;
+}
+
+static int all_free(const FreeExtentTree *t, int n, int lo, int len, int start, int end) {
+    if (end <= lo || start >= lo + len) return 1;
+    if (start <= lo && lo + len <= end) return t->prefix[n] == len;
+    return all_free(t, 2 * n, lo, len / 2, start, end) && all_free(t, 2 * n + 1, lo + len / 2, len / 2, start, end);
+}
+
+/**
+ * Returns 1 if the count blocks starting at start all lie on the disk and are free, 0 otherwise.
+ */
+int extent_tree_is_free(const FreeExtentTree *t, int start, int count) {
+    if (start < 0 || count < 0 || start + count > EXTENT_TREE_BLOCKS) return 0;
+    return all_free(t, 1, 0, EXTENT_TREE_BLOCKS, start, start + count);
+}
@@ -0,0 +1,22 @@
+#ifndef EXTENT_H
+#define EXTENT_H
+
+#include <stdint.h>
+
+#define EXTENT_TREE_BLOCKS 128 // Blocks covered by the tree, a power of two
+
+// Segment tree over the blocks of a disk that tracks runs of free blocks. Node 1 is the root, the children of node n
+// are 2n and 2n + 1, and node EXTENT_TREE_BLOCKS + b is the leaf for block b. Every node stores the free runs of the
+// blocks it covers as seen from its two ends and the longest one anywhere inside it.
+typedef struct {
+	uint8_t prefix[2 * EXTENT_TREE_BLOCKS];  // Free blocks at the low end of the node
+	uint8_t suffix[2 * EXTENT_TREE_BLOCKS];  // Free blocks at the high end of the node
+	uint8_t longest[2 * EXTENT_TREE_BLOCKS]; // Longest free run inside the node
+} FreeExtentTree;
+
+void extent_tree_init(FreeExtentTree *t);
+void extent_tree_set(FreeExtentTree *t, int start, int count, int free);
+int extent_tree_first_fit(const FreeExtentTree *t, int count);
+int extent_tree_is_free(const FreeExtentTree *t, int start, int count);
+
+#endif
@@ -3,6 +3,14 @@
 #include <stdint.h>
 #include <string.h>
 #include "fs-sim.h"
+#include "blkdev.h"
+#include "extent.h"
+#include "bitmap.h"
+#include "inodescan.h"
+#include "inodetab.h"
+#include "check.h"
+#include "trailer.h"
+#include "crc32c.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -11,38 +19,476 @@
 
 static char mounted_disk[64] = {0};
 static int cwd = 0;
-static Superblock superblock;
-static uint8_t buffer[1024] = {0};
-static int global_fd = -1;
+static Superblock *superblock = NULL; // Private copy of the superblock, also in mmap mode
+static InodeTable inodes;             // Decoded inode table of the mounted disk, stored into superblock on flush
+static uint8_t *buffer = NULL;  // Transfer buffer holding buffer_blocks blocks
+static const uint8_t zero_block[BLOCK_SIZE] = {0};
+static int buffer_blocks = 0;
+static int buffer_capacity = 0; // Blocks allocated for buffer
+static BlockDevice *disk = NULL;
 static int fs_mounted = 0;
+static int sb_dirty = 0;      // In-memory superblock differs from the one on disk
+static int write_through = 0; // Flush the superblock after every change instead of on sync
+static int use_mmap = 0;      // Mount disks through a shared memory mapping instead of pread/pwrite
+static int use_uring = 0;     // Batch block relocations through io_uring when the kernel supports it
+static int cache_frames = 32; // Blocks kept in the block cache, 0 disables it (not used in mmap mode)
+static int check_threads = 1; // Threads the mount checks split the inode table over
+static int force_check = 0;   // Run the mount checks even on a disk whose trailer says it was unmounted cleanly
+
+// Sequential read-ahead: a single window of prefetched blocks, owned by the file that last read sequentially
+#define RA_MIN_BLOCKS 4
+static int ra_max = 32;                  // Largest window in blocks, 0 disables read-ahead (not used in mmap mode)
+static int ra_next[126];                 // Block each file reads next if it keeps reading sequentially
+static int ra_size[126];                 // Window size each file has grown to, 0 after a random read
+static int ra_inode = -1;                // File the window belongs to, -1 if it is empty
+static int ra_first = 0, ra_count = 0;   // Blocks of that file held in the window
+static uint8_t *ra_data = NULL;
+static unsigned long ra_hits = 0, ra_fills = 0;
+
+// Name index: open-addressed hash table mapping (parent index, name) to the inode index of every inode in use
+#define NAME_INDEX_SLOTS 256
+static uint64_t name_index_key[NAME_INDEX_SLOTS];
+static int name_index_inode[NAME_INDEX_SLOTS]; // -1 marks an empty slot
+
+// Directory entries: the inodes in use under each parent value (127 is the root), linked in ascending index order
+static int child_head[128];  // First entry under each parent, -1 if none
+static int child_next[126];  // Next entry under the same parent, -1 at the end
+static int child_count[128]; // Number of entries under each parent
+
+// Free inodes: bit i % 64 of inode_free[i / 64] is set while inode i is free, and bit w of inode_free_words is set
+// while inode_free[w] is not zero, so the lowest free inode is found with two count-trailing-zeros
+#define INODE_WORDS ((126 + 63) / 64)
+static uint64_t inode_free[INODE_WORDS];
+static uint64_t inode_free_words;
+
+// Open-file table: a handle resolves a file once and caches where it lives, updated whenever the file moves
+#define MAX_OPEN_FILES 16
+typedef struct {
+    int open;
+    int inode;
+    int start; // Copy of inodes.start[inode]
+    int size;  // Copy of inodes.size[inode]
+} OpenFile;
+static OpenFile open_files[MAX_OPEN_FILES];
+
+// Trailer of the mounted disk as last read or written, whether this mount has written it yet, and whether the disk
+// passed every check so a flush may mark it clean
+static ImageTrailer trailer;
+static int trailer_written = 0;
+static int image_consistent = 0;
+
+// Free runs of the free block list. Block 0 holds the superblock and always counts as used.
+static FreeExtentTree free_extents;
 
+/**
+ * Write the superblock to the mounted disk, followed by its checksum in the trailer. In mmap mode this is the only
+ * place the superblock enters the mapping, and the mapping is synced before the trailer is written.
+ */
 static int write_superblock() {
-    if (lseek(global_fd, 0, SEEK_SET) < 0) return -1;
-    if (write(global_fd, &superblock, sizeof(Superblock)) != sizeof(Superblock)) return -1;
+    inode_table_store(&inodes, superblock);
+    if (blkdev_write_blocks(disk, 0, 1, superblock) < 0) return -1;
+    if (disk->map && blkdev_flush(disk) < 0) return -1;
+    trailer.checksum = trailer_checksum(superblock);
+    return trailer_write(disk->fd, &trailer);
+}
+
+/**
+ * Write the superblock back to the mounted disk if it has been modified since the last flush.
+ */
+static int sync_superblock(void) {
+    if (!sb_dirty || !disk) return 0;
+    if (write_superblock() < 0) return -1;
+    sb_dirty = 0;
     return 0;
 }
 
-static void recursive_delete(int i) {
-    if (superblock.inode[i].dir_parent & 0x80) {
-        // Delete children
-        for (int j = 0; j < 126; j++) {
-            if ((superblock.inode[j].used_size & 0x80) && (superblock.inode[j].dir_parent & 0x7F)==i) {
-                recursive_delete(j);
+/**
+ * Record a change to the in-memory superblock. In write-back mode (the default) the change reaches the disk on the
+ * next sync, remount or exit; in write-through mode it is written immediately.
+ *
+ * The first change of a mount counts the mount in the generation and marks the trailer dirty, creating it on a disk
+ * that has none, so a mount that changes nothing leaves the image untouched.
+ */
+static void mark_superblock_dirty(void) {
+    sb_dirty = 1;
+    if (!trailer_written || trailer.clean) {
+        if (!trailer_written) trailer.generation++;
+        trailer.clean = 0;
+        trailer_write(disk->fd, &trailer);
+        trailer_written = 1;
+    }
+    if (write_through) sync_superblock();
+}
+
+/**
+ * Flush the superblock in order before the next mount or at exit. If this mount has changed the disk and it is
+ * consistent, its trailer is then marked clean with the checksum of the superblock just written, which lets the next
+ * mount of the disk skip the checks. S only syncs, so a process that dies while the disk is mounted leaves it dirty.
+ */
+static int flush_clean(void) {
+    if (!disk) return 0;
+    if (sync_superblock() < 0) return -1;
+    if (!image_consistent || !trailer_written || trailer.clean) return 0;
+    trailer.clean = 1;
+    return trailer_write(disk->fd, &trailer);
+}
+
+/**
+ * Combine a parent index and a packed name into one key. Like strncmp, only the bytes up to the first NUL of the
+ * name count.
+ */
+static uint64_t name_key(int parent, uint64_t name) {
+    return (uint64_t)parent << 40 | inode_name_canonical(name);
+}
+
+static int name_index_slot(uint64_t key) {
+    return (key * 0x9E3779B97F4A7C15ull) >> 56; // Top 8 bits, NAME_INDEX_SLOTS == 256
+}
+
+/**
+ * Look up the inode called name in directory parent (127 for the root). Returns its index, or -1 if there is none.
+ */
+static int name_index_lookup(int parent, const char *name) {
+    uint64_t key = name_key(parent, inode_name_pack(name));
+    for (int s = name_index_slot(key); name_index_inode[s] >= 0; s = (s + 1) % NAME_INDEX_SLOTS) {
+        if (name_index_key[s] == key) return name_index_inode[s];
+    }
+    return -1;
+}
+
+static void name_index_insert(int i) {
+    uint64_t key = name_key(inodes.parent[i], inodes.name[i]);
+    int s = name_index_slot(key);
+    while (name_index_inode[s] >= 0) s = (s + 1) % NAME_INDEX_SLOTS;
+    name_index_key[s] = key;
+    name_index_inode[s] = i;
+}
+
+/**
+ * Remove inode i from the index, shifting later entries of its probe run back so lookups need no tombstones.
+ */
+static void name_index_remove(int i) {
+    uint64_t key = name_key(inodes.parent[i], inodes.name[i]);
+    int s = name_index_slot(key);
+    while (name_index_inode[s] != i) s = (s + 1) % NAME_INDEX_SLOTS;
+    name_index_inode[s] = -1;
+    for (int t = (s + 1) % NAME_INDEX_SLOTS; name_index_inode[t] >= 0; t = (t + 1) % NAME_INDEX_SLOTS) {
+        int home = name_index_slot(name_index_key[t]);
+        // Move the entry into the hole unless its home slot lies cyclically in (s, t]
+        if ((t > s && (home <= s || home > t)) || (t < s && home <= s && home > t)) {
+            name_index_key[s] = name_index_key[t];
+            name_index_inode[s] = name_index_inode[t];
+            name_index_inode[t] = -1;
+            s = t;
+        }
+    }
+}
+
+/**
+ * Link inode i into the entry list of its parent, keeping the list in index order.
+ */
+static void dir_link(int i) {
+    int parent = inodes.parent[i];
+    int *link = &child_head[parent];
+    while (*link >= 0 && *link < i) link = &child_next[*link];
+    child_next[i] = *link;
+    *link = i;
+    child_count[parent]++;
+}
+
+static void dir_unlink(int i) {
+    int parent = inodes.parent[i];
+    int *link = &child_head[parent];
+    while (*link != i) link = &child_next[*link];
+    *link = child_next[i];
+    child_count[parent]--;
+}
+
+static void inode_mark_free(int i) {
+    inode_free[i / 64] |= 1ull << (i % 64);
+    inode_free_words |= 1ull << (i / 64);
+}
+
+static void inode_mark_used(int i) {
+    inode_free[i / 64] &= ~(1ull << (i % 64));
+    if (inode_free[i / 64] == 0) inode_free_words &= ~(1ull << (i / 64));
+}
+
+/**
+ * Return the lowest free inode index, or -1 if the inode table is full.
+ */
+static int inode_lowest_free(void) {
+    if (inode_free_words == 0) return -1;
+    int w = __builtin_ctzll(inode_free_words);
+    return 64 * w + __builtin_ctzll(inode_free[w]);
+}
+
+/**
+ * Rebuild the name index, the directory entry lists and the free inode bitmap from the inode table of the mounted
+ * superblock.
+ */
+static void name_index_build(void) {
+    memset(name_index_inode, -1, sizeof(name_index_inode));
+    memset(child_head, -1, sizeof(child_head));
+    memset(child_count, 0, sizeof(child_count));
+    // The free inode bitmap is exactly the match of the in-use bytes against 0
+    scan_match_bytes(inodes.used, 126, 0, inode_free);
+    inode_free_words = 0;
+    for (int w = 0; w < INODE_WORDS; w++) {
+        if (inode_free[w]) inode_free_words |= 1ull << w;
+    }
+    uint64_t used[INODE_WORDS];
+    scan_match_bytes(inodes.used, 126, 1, used);
+    for (int w = INODE_WORDS - 1; w >= 0; w--) {
+        while (used[w]) {
+            int bit = 63 - __builtin_clzll(used[w]);
+            used[w] &= ~(1ull << bit);
+            int i = 64 * w + bit;
+            name_index_insert(i);
+            // Walking down from the top makes every link a push onto the front of its list
+            dir_link(i);
+        }
+    }
+}
+
+static uint8_t *free_map(Superblock *sb) {
+    return (uint8_t *)sb->free_block_list;
+}
+
+/**
+ * Mark count blocks starting at start as used, in the free block list and in the free-extent tree.
+ */
+static void claim_blocks(int start, int count) {
+    bitmap_set_range(free_map(superblock), 128, start, count);
+    extent_tree_set(&free_extents, start, count, 0);
+}
+
+static void release_blocks(int start, int count) {
+    bitmap_clear_range(free_map(superblock), 128, start, count);
+    extent_tree_set(&free_extents, start, count, 1);
+}
+
+/**
+ * Rebuild the free-extent tree from the free block list of the mounted superblock.
+ */
+static void free_extents_build(void) {
+    extent_tree_init(&free_extents);
+    int start = bitmap_next_zero(free_map(superblock), 128, 1);
+    while (start >= 0) {
+        int end = bitmap_next_set(free_map(superblock), 128, start);
+        if (end < 0) end = 128;
+        extent_tree_set(&free_extents, start, end - start, 1);
+        start = bitmap_next_zero(free_map(superblock), 128, end);
+    }
+}
+
+/**
+ * Forget the read-ahead state of inode i, or of every inode if i is -1. Must be called whenever the blocks of a
+ * file are written, moved or freed.
+ */
+static void ra_drop(int i) {
+    if (i < 0) {
+        memset(ra_next, 0, sizeof(ra_next));
+        memset(ra_size, 0, sizeof(ra_size));
+        ra_inode = -1;
+        return;
+    }
+    ra_next[i] = 0;
+    ra_size[i] = 0;
+    if (ra_inode == i) ra_inode = -1;
+}
+
+/**
+ * Read block block_num of file i into out from the read-ahead window. A sequential read that misses the window
+ * reads the block into out and refills the window with the blocks after it in one vectored transfer, doubling the
+ * window size each time up to ra_max. Returns -1 if the block was not served and has to be read directly.
+ */
+static int ra_read(int i, int block_num, uint8_t *out) {
+    int sequential = (block_num == ra_next[i]);
+    ra_next[i] = block_num + 1;
+    if (ra_inode == i && block_num >= ra_first && block_num < ra_first + ra_count) {
+        memcpy(out, ra_data + (size_t)(block_num - ra_first) * BLOCK_SIZE, BLOCK_SIZE);
+        ra_hits++;
+        return 0;
+    }
+    if (!sequential || ra_max <= 0 || disk->map) {
+        ra_size[i] = 0;
+        return -1;
+    }
+
+    int window = ra_size[i] ? ra_size[i] * 2 : RA_MIN_BLOCKS;
+    if (window > ra_max) window = ra_max;
+    ra_size[i] = window;
+    int count = inodes.size[i] - block_num;
+    if (count > window) count = window;
+    if (count <= 1) return -1;
+    if (!ra_data) {
+        ra_data = malloc((size_t)ra_max * BLOCK_SIZE);
+        if (!ra_data) return -1;
+    }
+    ra_inode = -1;
+    struct iovec iov[2] = {{out, BLOCK_SIZE}, {ra_data, (size_t)(count - 1) * BLOCK_SIZE}};
+    if (blkdev_readv_blocks(disk, inodes.start[i] + block_num, iov, 2) < 0) return -1;
+    ra_inode = i;
+    ra_first = block_num + 1;
+    ra_count = count - 1;
+    ra_fills++;
+    return 0;
+}
+
+/**
+ * Copy the current location of inode i into every handle open on it. Must be called whenever a file is resized or
+ * moved.
+ */
+static void handles_refresh(int i) {
+    for (int h = 0; h < MAX_OPEN_FILES; h++) {
+        if (open_files[h].open && open_files[h].inode == i) {
+            open_files[h].start = inodes.start[i];
+            open_files[h].size = inodes.size[i];
+        }
+    }
+}
+
+/**
+ * Close every handle open on inode i, or every handle if i is -1.
+ */
+static void handles_release(int i) {
+    for (int h = 0; h < MAX_OPEN_FILES; h++) {
+        if (i < 0 || open_files[h].inode == i) open_files[h].open = 0;
+    }
+}
+
+/**
+ * Free inode root and everything below it. The subtree is gathered into a worklist by walking the entry lists, the
+ * blocks of its files are merged into as few extents as possible, released from the free block list one extent at
+ * a time and zeroed with one call per extent.
+ */
+static void delete_subtree(int root) {
+    int work[126], n = 0;
+    uint8_t queued[126] = {0};
+    BlockExtent freed[126];
+    int num_freed = 0;
+
+    work[n++] = root;
+    queued[root] = 1;
+    for (int k = 0; k < n; k++) {
+        int i = work[k];
+        if (!inodes.is_dir[i]) {
+            freed[num_freed++] = (BlockExtent){inodes.start[i], inodes.size[i]};
+            continue;
+        }
+        for (int c = child_head[i]; c >= 0; c = child_next[c]) {
+            if (!queued[c]) {
+                queued[c] = 1;
+                work[n++] = c;
             }
         }
-    } else {
-        int size = superblock.inode[i].used_size & 0x7F;
-        int start = superblock.inode[i].start_block;
-        for (int j = start; j < start + size; j++) {
-            //printf("Delete: free %d\n", j);
-            superblock.free_block_list[j / 8] &= ~(1 << (7 - (j % 8)));
-            uint8_t zeroes[1024] = {0};
-            memset(zeroes, 0, 1024);
-            lseek(global_fd, j * 1024, SEEK_SET);
-            write(global_fd, zeroes, 1024);
+    }
+
+    // Only the root is linked into a directory that survives; the lists of deleted directories are simply reset
+    dir_unlink(root);
+    for (int k = 0; k < n; k++) {
+        int i = work[k];
+        name_index_remove(i);
+        inode_mark_free(i);
+        ra_drop(i);
+        handles_release(i);
+        if (inodes.is_dir[i]) {
+            child_head[i] = -1;
+            child_count[i] = 0;
         }
     }
-    memset(&superblock.inode[i], 0, sizeof(Inode));
+    for (int k = 0; k < n; k++) inode_table_clear(&inodes, work[k]);
+    // A path can name a directory above the current one; if that goes, fall back to the root
+    if (cwd != 0 && queued[cwd]) cwd = 0;
+
+    num_freed = blkdev_merge_extents(freed, num_freed);
+    for (int k = 0; k < num_freed; k++) release_blocks(freed[k].start, freed[k].count);
+    blkdev_zero_extents(disk, freed, num_freed);
+}
+
+/**
+ * Resize the transfer buffer to hold blocks blocks, keeping its contents. Blocks added at the end are zeroed.
+ */
+static int size_buffer(int blocks) {
+    if (blocks > buffer_capacity) {
+        uint8_t *grown = realloc(buffer, (size_t)blocks * BLOCK_SIZE);
+        if (!grown) return -1;
+        buffer = grown;
+        buffer_capacity = blocks;
+    }
+    if (blocks > buffer_blocks) {
+        memset(buffer + (size_t)buffer_blocks * BLOCK_SIZE, 0, (size_t)(blocks - buffer_blocks) * BLOCK_SIZE);
+    }
+    buffer_blocks = blocks;
+    return 0;
+}
+
+/**
+ * Step from directory dir (127 for the root) to its entry name, following . and .. like fs_cd does. Returns the
+ * directory reached, or -1 if name is not a directory in dir.
+ */
+static int step_dir(int dir, const char *name) {
+    if (strcmp(name, ".") == 0) return dir;
+    if (strcmp(name, "..") == 0) return (dir == 127) ? 127 : inodes.parent[dir];
+    int i = name_index_lookup(dir, name);
+    if (i < 0 || !inodes.is_dir[i]) return -1;
+    return i;
+}
+
+/**
+ * Split path into the directory holding its last component and that component. Paths starting with / are resolved
+ * from the root, others from the current working directory. Every component has 1 to 5 characters, so a trailing /
+ * or a // makes the path invalid. A path with no components, such as "/", leaves leaf empty. Returns -1 if a
+ * directory on the way does not exist, -2 if a component is longer than 5 characters and -3 if one is empty; failed,
+ * unless NULL, is then set to the length of the prefix of path that ends with that component.
+ */
+static int resolve_parent(const char *path, int *parent, char leaf[6], int *failed) {
+    const char *p = path;
+    int dir = (*p == '/' || cwd == 0) ? 127 : cwd;
+    if (*p == '/') p++;
+    leaf[0] = '\0';
+    // Past the leading /, every / must be followed by another component
+    while (*p || leaf[0] != '\0') {
+        int len = strcspn(p, "/");
+        int code = (len == 0) ? -3 : (len > 5) ? -2 : 0;
+        if (code < 0) {
+            if (failed) *failed = p + len - path;
+            return code;
+        }
+        memcpy(leaf, p, len);
+        leaf[len] = '\0';
+        p += len;
+        if (*p == '\0') break;
+        // Another component follows, so this one must be a directory
+        if ((dir = step_dir(dir, leaf)) < 0) {
+            if (failed) *failed = p - path;
+            return -1;
+        }
+        p++;
+    }
+    *parent = dir;
+    return 0;
+}
+
+/**
+ * Find the file (not directory) at path. Returns its inode index, or -1 if there is none.
+ */
+static int find_file(const char *path) {
+    int pd;
+    char leaf[6];
+    if (resolve_parent(path, &pd, leaf, NULL) < 0 || leaf[0] == '\0') return -1;
+    int i = name_index_lookup(pd, leaf);
+    if (i < 0 || inodes.is_dir[i]) return -1;
+    return i;
+}
+
+/**
+ * Release a disk and the superblock loaded from it.
+ */
+static void unmount_disk(BlockDevice *dev, Superblock *sb) {
+    free(sb);
+    blkdev_close(dev);
 }
 
 /**
@@ -74,184 +520,76 @@ static void recursive_delete(int i) {
  * A success fs_mount will change the current working directory to root
  */
 void fs_mount(char *new_disk_name){
+    // Pending changes must reach the current disk first, it may be the one being remounted
+    flush_clean();
+
     int fd = open(new_disk_name, O_RDWR);
     if (fd < 0){
         fprintf(stderr, "Error: Cannot find disk %s\n", new_disk_name);
         close(fd);
         return;
     }
-    Superblock sb;
-    lseek(fd, 0, SEEK_SET);
-    read(fd, &sb, sizeof(Superblock));
-
-    int prev_disk_fd = global_fd;
-    Superblock prev_superblock;
-    memcpy(&prev_superblock, &superblock, sizeof(Superblock));
-    global_fd = fd;
-    memcpy(&superblock, &sb, sizeof(Superblock));
-
-    // Check 1
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        uint8_t used_size = inode->used_size;
-        if (used_size <= 127) { // inode is free
-            uint8_t *inode_bytes = (uint8_t *)inode;
-            for (int j = 0; j < sizeof(Inode); j++) {
-                if (inode_bytes[j] != 0) {
-                    close(fd);
-                    global_fd = prev_disk_fd;
-                    superblock = prev_superblock;
-                    fprintf(stderr, "Error: File system in %s is inconsistent (error code: 1)\n", new_disk_name);
-                    return;
-                }
-            }
-        } else { // inode is in use
-            uint8_t *inode_bytes = (uint8_t *)inode;
-            int not_zero = 0;
-            for (int j = 0; j < sizeof(Inode); j++) {
-                if (inode_bytes[j] != 0) {
-                    not_zero++;
-                }
-            }
-            if (not_zero == 0) {
-                close(fd);
-                global_fd = prev_disk_fd;
-                superblock = prev_superblock;
-                fprintf(stderr, "Error: File system in %s is inconsistent (error code: 1)\n", new_disk_name);
-                return;
-            }
-        }
-    }    
-    
-
-    // Check 2
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        uint8_t used_size = inode->used_size;
-        uint8_t dir_parent = inode->dir_parent;
-        if(used_size > 127) { // inode is in use
-            if (dir_parent <= 127) { // inode is a file
-                uint8_t size = inode->used_size & 0x7F;
-                uint8_t start_block = inode->start_block;
-                if((start_block < 1) || (start_block > 127)){
-                    close(fd);
-                    global_fd = prev_disk_fd;
-                    superblock = prev_superblock;
-                    fprintf(stderr, "Error: File system in %s is inconsistent (error code: 2)\n", new_disk_name);
-                    return;
-                }
-                if (start_block + size - 1 > 127) {
-                    close(fd);
-                    global_fd = prev_disk_fd;
-                    superblock = prev_superblock;
-                    fprintf(stderr, "Error: File system in %s is inconsistent (error code: 2)\n", new_disk_name);
-                    return;
-                }
-            }
-        }
-    }
-
-    // Check 3
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        uint8_t dir_parent = inode->dir_parent;
-        if (dir_parent > 127) { // inode is a directory
-            uint8_t start_block = inode->start_block;
-            uint8_t used_size = inode->used_size;
-            if ((start_block != 0) || (used_size != 0 && used_size != 128)) {
-                close(fd);
-                global_fd = prev_disk_fd;
-                superblock = prev_superblock;
-                fprintf(stderr, "Error: File system in %s is inconsistent (error code: 3)\n", new_disk_name);
-                return;
-            }
-        }
-    }
-
-    // Check 4
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        uint8_t used_size = inode->used_size;
-        if (used_size > 127) { // inode is in use
-            uint8_t parent = inode->dir_parent & 0x7F;
-            if (parent == 126){
-                close(fd);
-                global_fd = prev_disk_fd;
-                superblock = prev_superblock;
-                fprintf(stderr, "Error: File system in %s is inconsistent (error code: 4)\n", new_disk_name);
-                return;
-            }
-            else if (parent >= 0 && parent <= 125){
-                Inode *parent_inode = &superblock.inode[parent];
-                uint8_t used_parent = parent_inode->used_size >> 7;
-                uint8_t directory_parent = parent_inode->dir_parent >> 7;
-                if (directory_parent == 0 || used_parent == 0){
-                    close(fd);
-                    global_fd = prev_disk_fd;
-                    superblock = prev_superblock;
-                    fprintf(stderr, "Error: File system in %s is inconsistent (error code: 4)\n", new_disk_name);
-                    return;
-                }
-            }
-        }
-    }
-
-    // Check 5
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        uint8_t used = inode->used_size >> 7;
-        if (used == 1) {
-            uint8_t parent = inode->dir_parent & 0x7F;
-            for (int j = i + 1; j < 126; j++) {
-                Inode *inode2 = &superblock.inode[j];
-                uint8_t inode2_used = inode2->used_size >> 7;
-                if (inode2_used == 1) {
-                    uint8_t parent2 = inode2->dir_parent & 0x7F;
-                    if (parent == parent2 && strncmp(inode->name, inode2->name, 5) == 0) {
-                        close(fd);
-                        global_fd = prev_disk_fd;
-                        superblock = prev_superblock;
-                        fprintf(stderr, "Error: File system in %s is inconsistent (error code: 5)\n", new_disk_name);
-                        return;
-                    }
-                }
-            }
-        }
+    BlockDevice *dev = use_mmap ? blkdev_open_mmap(fd, 128) : NULL;
+    if (!dev && use_uring) dev = blkdev_open_uring(fd);
+    if (!dev) dev = blkdev_open_pio(fd);
+    if (!dev->map && cache_frames > 0) {
+        BlockDevice *cached = blkdev_open_cache(dev, cache_frames);
+        if (cached) dev = cached;
     }
-
-    // Check 6
-    int block_usage[128] = {0};
-    for (int i = 0; i < 126; i++) {
-        if (!(superblock.inode[i].used_size & 0x80)) continue;
-        if (!(superblock.inode[i].dir_parent & 0x80)) {
-            int start = superblock.inode[i].start_block;
-            int size = superblock.inode[i].used_size & 0x7F;
-            for (int b = start; b < start + size; b++) {
-                block_usage[b]++;
-            }
-        }
+    // Even in mmap mode the superblock is a private copy, so metadata changes only reach the disk when it is written
+    Superblock *sb = malloc(sizeof(Superblock));
+    blkdev_read_blocks(dev, 0, 1, sb);
+
+    BlockDevice *prev_disk = disk;
+    Superblock *prev_superblock = superblock;
+    disk = dev;
+    superblock = sb;
+
+    // The checksum in the trailer is verified first: a superblock that is not the one this program last wrote always
+    // gets the full checks. They run over a decoded copy of the new inode table, which becomes the mounted one if
+    // they all pass. A disk last flushed cleanly from a consistent mount passes them all.
+    ImageTrailer new_trailer;
+    int intact = trailer_read(dev->fd, &new_trailer) == 0 && new_trailer.checksum == trailer_checksum(superblock);
+    InodeTable t;
+    uint8_t bad_blocks[CHECK_BLOCKS / 8] = {0};
+    inode_table_load(&t, superblock);
+    int skip = intact && new_trailer.clean && !force_check;
+    int error = skip ? 0 : check_image(superblock, &t, bad_blocks, check_threads);
+    if (error) {
+        unmount_disk(dev, sb);
+        disk = prev_disk;
+        superblock = prev_superblock;
+        fprintf(stderr, "Error: File system in %s is inconsistent (error code: %d)\n", new_disk_name, error);
+        return;
     }
-    for (int b = 1; b < 128; b++) {
-        if (((superblock.free_block_list[(b) / 8]>> (7 - (b % 8))) & 1) && block_usage[b] != 1){
-            fprintf(stderr, "Error: File system in %s is inconsistent (error code: 6)\n", new_disk_name);
-        }
-        if (!((superblock.free_block_list[(b) / 8]>> (7 - (b % 8))) & 1) && block_usage[b] != 0){
-            fprintf(stderr, "Error: File system in %s is inconsistent (error code: 5)\n", new_disk_name);
-        }
+    // Check 6 is reported block by block but does not prevent the mount
+    int b = bitmap_next_set(bad_blocks, CHECK_BLOCKS, 0);
+    while (b >= 0) {
+        fprintf(stderr, "Error: File system in %s is inconsistent (error code: %d)\n", new_disk_name,
+                bitmap_test(free_map(superblock), b) ? 6 : 5);
+        b = bitmap_next_set(bad_blocks, CHECK_BLOCKS, b + 1);
     }
 
     // no inconsistencies
     // mount
     fs_mounted = 1;
-    if (prev_disk_fd>=0) {
-        close(prev_disk_fd);
-    }
-
-    memset(buffer, 0, sizeof(buffer));
+    unmount_disk(prev_disk, prev_superblock);
+    trailer = new_trailer;
+    trailer_written = 0;
+    image_consistent = (bitmap_next_set(bad_blocks, CHECK_BLOCKS, 0) < 0);
+
+    buffer_blocks = 0;
+    size_buffer(1);
+    ra_drop(-1);
+    handles_release(-1);
+    inodes = t;
+    name_index_build();
+    free_extents_build();
     memset(mounted_disk, 0, sizeof(mounted_disk));
     strcpy(mounted_disk, new_disk_name);
     //printf("Debug mount: mounted disk %s\n", mounted_disk);
     cwd = 0;
+    sb_dirty = 0;
     
 }
 
@@ -274,70 +612,60 @@ void fs_create(char name[5], int size){
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
-    int free_inode_index = -1;
-    for (int i = 0; i < 126; i++) {
-        if ((superblock.inode[i].used_size & 0x80) == 0) { // Free inode
-            free_inode_index = i;
-            break;
-        }
+    int pd;
+    char leaf[6];
+    int failed;
+    int resolved = resolve_parent(name, &pd, leaf, &failed);
+    if (resolved == -3) {
+        fprintf(stderr, "Error: Name %s has an empty component\n", name);
+        return;
+    }
+    if (resolved == -2) {
+        fprintf(stderr, "Error: Name %s has a component longer than 5 characters\n", name);
+        return;
+    }
+    if (resolved < 0) {
+        fprintf(stderr, "Error: Directory %.*s does not exist\n", failed, name);
+        return;
     }
+    int free_inode_index = inode_lowest_free();
     if (free_inode_index == -1) {
         fprintf(stderr, "Error: Superblock in disk %s is full, cannot create %s\n", mounted_disk, name);
         return;
     }
 
-    int pd = (cwd == 0) ? 127 : cwd;
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80) != 0 && (inode->dir_parent & 0x7F) == pd) { 
-            if (strncmp(inode->name, name, 5) == 0) { 
-                fprintf(stderr, "Error: File or directory %s already exists\n", name);
-                return;
-            }
-        }
-    }
-    if (strncmp(name, ".", 5) == 0 || strncmp(name, "..", 5) == 0) {
+    if (leaf[0] == '\0' || name_index_lookup(pd, leaf) >= 0) {
         fprintf(stderr, "Error: File or directory %s already exists\n", name);
         return;
     }
-
-
-    int start_block = -1, count = 0;
-    for (int i = 1; i < 128; i++) {
-        int bit = (superblock.free_block_list[i / 8] >> (7 - (i % 8))) & 1;
-        if (bit == 0) {
-            if (count == 0) start_block = i;
-            count++;
-            if (count == size) break;
-        } else {
-            count = 0;
-        }
-    }
-    if (count < size) {
-        //printf("Debug create: disk name: %s\n", mounted_disk);
-        fprintf(stderr, "Error: Cannot allocate %d blocks on %s\n", size, mounted_disk);
+    if (strcmp(leaf, ".") == 0 || strcmp(leaf, "..") == 0) {
+        fprintf(stderr, "Error: File or directory %s already exists\n", name);
         return;
     }
 
-    for (int i = start_block; i < start_block + size; i++) {
-        superblock.free_block_list[i / 8] |= (1 << (7 - (i % 8)));
-    }
 
-    Inode *new_inode = &superblock.inode[free_inode_index];
-    memset(new_inode, 0, sizeof(Inode));
-    strncpy(new_inode->name, name, 5);
-    new_inode->used_size = (0x80 | size);
-    new_inode->start_block = (size > 0) ? start_block : 0;
-    if (size == 0){
-        new_inode->dir_parent = 0x80 | ((cwd == 0 ? 127 : cwd) & 0x7F); 
-    }
-    else {
-        new_inode->dir_parent = ((cwd == 0 ? 127 : cwd) & 0x7F); 
+    // Lowest run of size free blocks
+    int start_block = 0;
+    if (size > 0) {
+        start_block = extent_tree_first_fit(&free_extents, size);
+        if (start_block < 0) {
+            fprintf(stderr, "Error: Cannot allocate %d blocks on %s\n", size, mounted_disk);
+            return;
+        }
+        claim_blocks(start_block, size);
     }
 
-    write_superblock();
-    //printf("Create: inode: %d, size: %d, dir_parent: %d, name: %5s\n", free_inode_index, 
-    //new_inode -> used_size, new_inode -> dir_parent, name);
+    inodes.name[free_inode_index] = inode_name_pack(leaf);
+    inodes.used[free_inode_index] = 1;
+    inodes.size[free_inode_index] = size;
+    inodes.start[free_inode_index] = start_block;
+    inodes.is_dir[free_inode_index] = (size == 0);
+    inodes.parent[free_inode_index] = pd;
+    name_index_insert(free_inode_index);
+    dir_link(free_inode_index);
+    inode_mark_used(free_inode_index);
+
+    mark_superblock_dirty();
 }
 
 
@@ -358,22 +686,15 @@ void fs_delete(char name[5]){
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
-    int target_index = -1;
-    int pd = (cwd == 0) ? 127 : cwd;
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80) != 0 && 
-            (inode->dir_parent & 0x7F) == pd && strncmp(inode->name, name, 5) == 0) { 
-            target_index = i;
-            break;
-        }
-    }
+    int pd, target_index = -1;
+    char leaf[6];
+    if (resolve_parent(name, &pd, leaf, NULL) == 0 && leaf[0] != '\0') target_index = name_index_lookup(pd, leaf);
     if (target_index == -1) {
         fprintf(stderr, "Error: File or directory %s does not exist\n", name);
         return;
     }
-    recursive_delete(target_index);
-    write_superblock();
+    delete_subtree(target_index);
+    mark_superblock_dirty();
 }
 
 
@@ -395,35 +716,22 @@ void fs_delete(char name[5]){
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
-    int file_index = -1;
-    int pd = (cwd == 0) ? 127 : cwd;
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80) != 0 && 
-            (inode->dir_parent & 0x7F) == pd && 
-            strncmp(inode->name, name, 5) == 0 && 
-            (inode->dir_parent & 0x80) == 0) { 
-            file_index = i;
-            break;
-        }
-    }
+    int file_index = find_file(name);
     if (file_index == -1) {
         fprintf(stderr, "Error: File %s does not exist\n", name);
         return;
     }
 
-    Inode *file_inode = &superblock.inode[file_index];
-    uint8_t file_size = file_inode->used_size & 0x7F;
-    uint8_t start = file_inode->start_block;
+    uint8_t file_size = inodes.size[file_index];
+    uint8_t start = inodes.start[file_index];
 
     if (block_num < 0 || block_num >= file_size) {
         fprintf(stderr, "Error: %s does not have block %d\n", name, block_num);
         return;
     }
-    lseek(global_fd, (start + block_num ) * 1024, SEEK_SET);
-    read(global_fd, buffer, 1024);
-
-
+    size_buffer(1);
+    if (ra_read(file_index, block_num, buffer) == 0) return;
+    blkdev_read_blocks(disk, start + block_num, 1, buffer);
 }
 
 
@@ -444,47 +752,201 @@ void fs_write(char name[5], int block_num){
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
-    if (buffer == NULL) {
+    int file_index = find_file(name);
+    if (file_index == -1) {
+        fprintf(stderr, "Error: File %s does not exist\n", name);
+        return;
+    }
+
+    uint8_t file_size = inodes.size[file_index];
+
+    if (block_num < 0 || block_num >= file_size) {
+        fprintf(stderr, "Error: %s does not have block %d\n", name, block_num);
+        return;
+    }
+
+    //printf("Write: buffer %s\n", buffer);
+    int start = inodes.start[file_index];
+
+    ra_drop(file_index);
+    blkdev_write_blocks(disk, start + block_num, 1, buffer);
+}
+
+
+/**
+ * Put count blocks of the file with the given name, starting at block first_block, into the buffer with a single
+ * read. The buffer is resized to count blocks. A count of 0 reads from first_block to the end of the file.
+ *
+ * Errors are reported as for fs_read. If the range runs past the end of the file, the first block outside the
+ * file is named:
+ * Error: <file name> does not have block <block_num>
+ */
+void fs_read_range(char name[5], int first_block, int count){
+    if (!fs_mounted) {
+        fprintf(stderr, "Error: No file system is mounted\n");
+        return;
+    }
+    int file_index = find_file(name);
+    if (file_index == -1) {
+        fprintf(stderr, "Error: File %s does not exist\n", name);
+        return;
+    }
+
+    int file_size = inodes.size[file_index];
+    if (count == 0) count = file_size - first_block;
+
+    if (first_block < 0 || first_block >= file_size) {
+        fprintf(stderr, "Error: %s does not have block %d\n", name, first_block);
+        return;
+    }
+    if (first_block + count > file_size) {
+        fprintf(stderr, "Error: %s does not have block %d\n", name, file_size);
+        return;
+    }
+    if (size_buffer(count) < 0) {
         fprintf(stderr, "Error: Buffer is not initialized\n");
         return;
     }
-    int file_index = -1;
-    int pd = (cwd == 0) ? 127 : cwd;
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80) != 0 && 
-            (inode->dir_parent & 0x7F) == pd && 
-            strncmp(inode->name, name, 5) == 0 && 
-            (inode->dir_parent & 0x80) == 0) { 
-            file_index = i;
-            break;
-        }
+    blkdev_read_blocks(disk, inodes.start[file_index] + first_block, count, buffer);
+}
+
+
+/**
+ * Put count blocks of the buffer into the file with the given name, starting at block first_block, with a single
+ * vectored write. Blocks beyond what the buffer holds are written as zeroes from a shared zero block instead of
+ * growing the buffer; a buffer holding more than count blocks is shrunk to count.
+ *
+ * Errors are reported as for fs_write. If the range runs past the end of the file, the first block outside the
+ * file is named:
+ * Error: <file name> does not have block <block_num>
+ */
+void fs_write_range(char name[5], int first_block, int count){
+    if (!fs_mounted) {
+        fprintf(stderr, "Error: No file system is mounted\n");
+        return;
     }
+    int file_index = find_file(name);
     if (file_index == -1) {
         fprintf(stderr, "Error: File %s does not exist\n", name);
         return;
     }
 
-    Inode *file_inode = &superblock.inode[file_index];
-    uint8_t file_size = file_inode->used_size & 0x7F; 
+    int file_size = inodes.size[file_index];
 
-    if (block_num < 0 || block_num >= file_size) {
-        fprintf(stderr, "Error: %s does not have block %d\n", name, block_num);
+    if (first_block < 0 || first_block >= file_size) {
+        fprintf(stderr, "Error: %s does not have block %d\n", name, first_block);
         return;
     }
+    if (first_block + count > file_size) {
+        fprintf(stderr, "Error: %s does not have block %d\n", name, file_size);
+        return;
+    }
+    if (buffer_blocks > count) size_buffer(count);
+    struct iovec iov[128];
+    int iovcnt = 0;
+    iov[iovcnt++] = (struct iovec){buffer, (size_t)buffer_blocks * BLOCK_SIZE};
+    for (int k = buffer_blocks; k < count; k++) iov[iovcnt++] = (struct iovec){(void *)zero_block, BLOCK_SIZE};
+    ra_drop(file_index);
+    blkdev_writev_blocks(disk, inodes.start[file_index] + first_block, iov, iovcnt);
+}
 
-    //printf("Write: buffer %s\n", buffer);
-    int start = file_inode->start_block;
 
-    lseek(global_fd, (start + block_num) * 1024, SEEK_SET);
-    write(global_fd, buffer, 1024);
+/**
+ * Open the file at path and return a handle for fs_read_handle and fs_write_handle, the lowest one free. The handle
+ * stays valid until fs_close, until the file is deleted or until another disk is mounted; resizing and
+ * defragmentation keep it pointing at the file.
+ *
+ * Errors are reported as for fs_read. If all MAX_OPEN_FILES handles are in use, the following error is printed:
+ * Error: Too many open files
+ *
+ * Returns the handle, or -1 on error.
+ */
+int fs_open(char name[5]){
+    if (!fs_mounted) {
+        fprintf(stderr, "Error: No file system is mounted\n");
+        return -1;
+    }
+    int file_index = find_file(name);
+    if (file_index == -1) {
+        fprintf(stderr, "Error: File %s does not exist\n", name);
+        return -1;
+    }
+    for (int h = 0; h < MAX_OPEN_FILES; h++) {
+        if (!open_files[h].open) {
+            open_files[h] = (OpenFile){1, file_index, inodes.start[file_index], inodes.size[file_index]};
+            return h;
+        }
+    }
+    fprintf(stderr, "Error: Too many open files\n");
+    return -1;
+}
 
-    write_superblock();
+/**
+ * Close a handle returned by fs_open. If it is not open, the following error is printed:
+ * Error: Handle <handle> is not open
+ */
+void fs_close(int handle){
+    if (handle < 0 || handle >= MAX_OPEN_FILES || !open_files[handle].open) {
+        fprintf(stderr, "Error: Handle %d is not open\n", handle);
+        return;
+    }
+    open_files[handle].open = 0;
 }
 
+/**
+ * Look up an open handle, printing the error for a closed one. Returns NULL if handle is not open.
+ */
+static OpenFile *get_handle(int handle) {
+    if (!fs_mounted) {
+        fprintf(stderr, "Error: No file system is mounted\n");
+        return NULL;
+    }
+    if (handle < 0 || handle >= MAX_OPEN_FILES || !open_files[handle].open) {
+        fprintf(stderr, "Error: Handle %d is not open\n", handle);
+        return NULL;
+    }
+    return &open_files[handle];
+}
+
+static void print_no_block(OpenFile *f, int block_num) {
+    char name[6];
+    inode_name_unpack(inodes.name[f->inode], name);
+    name[5] = '\0';
+    fprintf(stderr, "Error: %s does not have block %d\n", name, block_num);
+}
+
+/**
+ * Same as fs_read for the file behind an open handle, without looking its name up.
+ */
+void fs_read_handle(int handle, int block_num){
+    OpenFile *f = get_handle(handle);
+    if (!f) return;
+    if (block_num < 0 || block_num >= f->size) {
+        print_no_block(f, block_num);
+        return;
+    }
+    size_buffer(1);
+    if (ra_read(f->inode, block_num, buffer) == 0) return;
+    blkdev_read_blocks(disk, f->start + block_num, 1, buffer);
+}
 
 /**
- * Flushes the buffer by zeroing it and writes the new bytes into the buffer. 
+ * Same as fs_write for the file behind an open handle, without looking its name up.
+ */
+void fs_write_handle(int handle, int block_num){
+    OpenFile *f = get_handle(handle);
+    if (!f) return;
+    if (block_num < 0 || block_num >= f->size) {
+        print_no_block(f, block_num);
+        return;
+    }
+    ra_drop(f->inode);
+    blkdev_write_blocks(disk, f->start + block_num, 1, buffer);
+}
+
+
+/**
+ * Flushes the buffer by zeroing it and shrinking it back to one block, and writes the new bytes into the buffer. 
  * Error handling is not handled in this function.
  */
 void fs_buff(char buff[1024]){
@@ -492,7 +954,8 @@ void fs_buff(char buff[1024]){
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
-    memset(buffer, 0, 1024);
+    buffer_blocks = 0;
+    size_buffer(1);
     int len = strlen((char*)buff);
     memcpy(buffer, buff, len);
 }
@@ -524,29 +987,13 @@ void fs_ls(void){
         parent_of_cwd = 127;
     } else {
         // Get the parent directory from the inode of cwd
-        parent_of_cwd = superblock.inode[cwd].dir_parent & 0x7F;
+        parent_of_cwd = inodes.parent[cwd];
     }
 
     // Set pd based on cwd
     int pd = (cwd == 0) ? 127 : cwd;
 
-    int num_files_in_cwd = 0, num_files_in_parent = 0;
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80)) { // Check if inode is in use
-            int inode_parent = inode->dir_parent & 0x7F;
-
-            // Count entries in the current working directory
-            if (inode_parent == pd) {
-                num_files_in_cwd++;
-            }
-
-            // Count entries in the parent directory
-            if (inode_parent == parent_of_cwd) {
-                num_files_in_parent++;
-            }
-        }
-    }
+    int num_files_in_cwd = child_count[pd], num_files_in_parent = child_count[parent_of_cwd];
 
     // Print . and .. with their respective counts
     printf(".   %5d\n", num_files_in_cwd + 2); // Including . and potentially hidden entries
@@ -560,29 +1007,14 @@ void fs_ls(void){
 
 
     // List all files and directories in the current directory
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
+    for (int i = child_head[pd]; i >= 0; i = child_next[i]) {
         char name[6];
-        memcpy(name, superblock.inode[i].name, 5);
+        inode_name_unpack(inodes.name[i], name);
         name[5] = '\0';
-        // Check if the inode is in use and belongs to the current working directory
-        if ((inode->used_size & 0x80) && (inode->dir_parent & 0x7F) == pd) {
-            if (inode->dir_parent & 0x80) { // Directory
-                int num_children = 0;
-
-                // Count children in this directory
-                for (int j = 0; j < 126; j++) {
-                    if ((superblock.inode[j].used_size & 0x80) &&
-                        (superblock.inode[j].dir_parent & 0x7F) == i) {
-                        num_children++;
-                    }
-                }
-
-                printf("%-5s %3d\n", name, num_children + 2);
-            } else { // File
-                uint8_t file_size = inode->used_size & 0x7F; // Extract file size
-                printf("%-5s %3d KB\n", name, file_size);
-            }
+        if (inodes.is_dir[i]) { // Directory
+            printf("%-5s %3d\n", name, child_count[i] + 2);
+        } else { // File
+            printf("%-5s %3d KB\n", name, inodes.size[i]);
         }
     }
 }
@@ -619,136 +1051,60 @@ void fs_resize(char name[5], int new_size){
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
-    Inode *file_inode = NULL;
-    int pd = (cwd == 0) ? 127 : cwd;
-    
-    for (int i = 0; i < 126; i++) {
-        if ((superblock.inode[i].used_size & 0x80) && // In use
-            !(superblock.inode[i].dir_parent & 0x80) && // Not a directory
-            (superblock.inode[i].dir_parent & 0x7F) == pd && // In the current directory
-            strncmp(superblock.inode[i].name, name, 5) == 0) { // Name matches
-            file_inode = &superblock.inode[i];
-            break;
-        }
-    }
-
-    if (!file_inode) {
+    int file_index = find_file(name);
+    if (file_index == -1) {
         fprintf(stderr, "Error: File %s does not exist\n", name);
         return;
     }
 
-    int current_size = file_inode->used_size & 0x7F; // Extract current size
-    int start_block = file_inode->start_block;
+    int current_size = inodes.size[file_index];
+    int start_block = inodes.start[file_index];
+    ra_drop(file_index);
 
     // If increasing the size
     if (new_size > current_size) {
-        int additional_blocks_needed = new_size - current_size;
-        int free_space_contiguous = 0;
-
-        // Check if there are enough contiguous blocks after the current file
-        for (int i = start_block + current_size; i < 128; i++) {
-            if (!(superblock.free_block_list[i / 8] >> (7 - (i % 8))) & 1) {
-                free_space_contiguous++;
-                if (free_space_contiguous == additional_blocks_needed) {
-                    // Update inode and mark blocks as used
-                    for (int j = start_block + current_size; j < start_block + new_size; j++) {
-                        superblock.free_block_list[j / 8] |= (1 << ( 7 - (j % 8)));
-                    }
-                    file_inode->used_size = (file_inode->used_size & 0x80) | new_size; // Update size
-                    write_superblock();
-                    return;
-                }
-            } else {
-                break;
-            }
+        // Grow in place if the blocks right after the file are free
+        if (extent_tree_is_free(&free_extents, start_block + current_size, new_size - current_size)) {
+            claim_blocks(start_block + current_size, new_size - current_size);
+            inodes.size[file_index] = new_size;
+            handles_refresh(file_index);
+            mark_superblock_dirty();
+            return;
         }
 
-        // Not enough contiguous blocks; try to relocate the file
-        free_space_contiguous = 0;
-        int new_start_block = -1;
-
-        for (int i = 1; i < 127 - new_size; i++) { // Start from block 1 (superblock is block 0)
-            if (!((superblock.free_block_list[i / 8] >> (7 - (i % 8))) & 1)) {
-                if (free_space_contiguous == 0) {
-                    new_start_block = i;
-                }
-                free_space_contiguous++;
-                if (free_space_contiguous == new_size) {
-                    //printf("Resize: index %d\n", new_start_block);
-                    // Relocate the file
-                    char *temp_buf = malloc(new_size * 1024);
-                    
-                    for (int j = 0; j < current_size; j++) {
-                        // Copy data from old blocks to new blocks
-                        lseek(global_fd, (start_block + j) * 1024, SEEK_SET);
-                        read(global_fd, temp_buf + j*1024, 1024);
-                    }
-                    //printf("Resize: buffer %s\n",temp_buf);
-
-                    // Update the free block list: clear old blocks
-                    for (int j = start_block; j < start_block + current_size; j++) {
-                        //printf("Resize: clear block %d\n", j);
-                        superblock.free_block_list[j / 8] &= ~(1 << (7 - (j % 8)));
-                        uint8_t zeroes[1024] = {0};
-                        memset(zeroes, 0, 1024);
-                        lseek(global_fd, j * 1024, SEEK_SET);
-                        write(global_fd, zeroes, 1024);
-                    }
-
-                    // Mark new blocks as used
-                    for (int j = new_start_block; j < new_start_block + current_size; j++) {
-                        superblock.free_block_list[j / 8] |= (1 << (7 - (j % 8)));
-                        
-                    }
-
-                    for (int j = 0; j < current_size; j++) {
-                        // Copy data from old blocks to new blocks
-                        lseek(global_fd, (j + new_start_block) * 1024, SEEK_SET);
-                        write(global_fd, temp_buf + j*1024, 1024);
-                    }
-
-                    for (int j = new_start_block + current_size; j < new_start_block - current_size + new_size; j++) {
-                        //printf("Resize: free %d\n", j);
-                        superblock.free_block_list[j / 8] &= ~(1 << (7 - (j % 8)));
-                        uint8_t zeroes[1024] = {0};
-                        memset(zeroes, 0, 1024);
-                        lseek(global_fd, j * 1024, SEEK_SET);
-                        write(global_fd, zeroes, 1024);
-                    }
-
-                    // Update inode
-                    free(temp_buf);
-                    file_inode->start_block = new_start_block;
-                    file_inode->used_size = (file_inode->used_size & 0x80) | new_size;
-                    write_superblock();
-                    return;
-                }
-            } else {
-                free_space_contiguous = 0;
-            }
+        // Not enough contiguous blocks; relocate the file to the lowest run that fits, not counting its own blocks
+        int new_start_block = extent_tree_first_fit(&free_extents, new_size);
+        if (new_start_block < 0) {
+            fprintf(stderr, "Error: File %s cannot expand to size %d\n", name, new_size);
+            return;
         }
+        // Copy data from old blocks to new blocks and zero the old blocks
+        BlockMove move = {start_block, new_start_block, current_size};
+        blkdev_move_blocks(disk, &move, 1);
+        release_blocks(start_block, current_size);
+        // Mark new blocks as used, including the ones the file grows into
+        claim_blocks(new_start_block, new_size);
+        blkdev_zero_blocks(disk, new_start_block + current_size, new_size - current_size);
 
-        // If no space is found
-        fprintf(stderr, "Error: File %s cannot expand to size %d\n", name, new_size);
+        // Update inode
+        inodes.start[file_index] = new_start_block;
+        inodes.size[file_index] = new_size;
+        handles_refresh(file_index);
+        mark_superblock_dirty();
         return;
     }
 
     // If decreasing the size
     if (new_size < current_size) {
         // Zero out the unused blocks
-        for (int j = start_block + new_size; j <= start_block + current_size - new_size; j++) {
-            //printf("Resize: free %d\n", j);
-            superblock.free_block_list[j / 8] &= ~(1 << (7 - (j % 8)));
-            uint8_t zeroes[1024] = {0};
-            memset(zeroes, 0, 1024);
-            lseek(global_fd, j * 1024, SEEK_SET);
-            write(global_fd, zeroes, 1024);
-        }
+        release_blocks(start_block + new_size, current_size - new_size);
+        blkdev_zero_blocks(disk, start_block + new_size, current_size - new_size);
 
         // Update inode
-        file_inode->used_size = (file_inode->used_size & 0x80) | new_size;
+        inodes.size[file_index] = new_size;
+        handles_refresh(file_index);
     }
-    write_superblock();
+    mark_superblock_dirty();
 }
 
 
@@ -766,14 +1122,20 @@ void fs_defrag(void){
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
+    // Files are the inodes in use without the directory bit, matched a vector of inodes at a time
     int order[126], count=0;
-    for (int i = 0; i < 126; i++) {
-        if ((superblock.inode[i].used_size & 0x80) && !(superblock.inode[i].dir_parent & 0x80)) order[count++] = i;
+    uint64_t used[INODE_WORDS], dirs[INODE_WORDS];
+    scan_match_bytes(inodes.used, 126, 1, used);
+    scan_match_bytes(inodes.is_dir, 126, 1, dirs);
+    for (int w = 0; w < INODE_WORDS; w++) {
+        for (uint64_t files = used[w] & ~dirs[w]; files; files &= files - 1) {
+            order[count++] = 64 * w + __builtin_ctzll(files);
+        }
     }
     // Sort by start block
     for (int a = 0; a < count; a++) {
         for (int b = a+1; b < count; b++) {
-            if (superblock.inode[order[a]].start_block > superblock.inode[order[b]].start_block) {
+            if (inodes.start[order[a]] > inodes.start[order[b]]) {
                 int tmp = order[a]; 
                 order[a]=order[b]; 
                 order[b]=tmp;
@@ -781,15 +1143,14 @@ void fs_defrag(void){
         }
     }
     int next_free_block = 1; // Start after the superblock (block 0)
+    BlockMove moves[126];
+    int move_count = 0;
 
     // Iterate over inodes, finding files and directories in order of their current start blocks
     for (int i = 0; i < count; i++) {
         int inode_index = order[i];
-        Inode *inode = &superblock.inode[inode_index];
-
-        // Check if the inode is in use and represents a file (not a directory)
-        int file_size = inode->used_size & 0x7F; // Get the file size in blocks
-        int old_start_block = inode->start_block;
+        int file_size = inodes.size[inode_index];
+        int old_start_block = inodes.start[inode_index];
 
         // If the file is already at the correct position, continue
         if (old_start_block == next_free_block) {
@@ -797,50 +1158,25 @@ void fs_defrag(void){
             continue;
         }
 
-        char *temp_buf = malloc(file_size * 1024);
-                    
-        for (int j = 0; j < file_size; j++) {
-            // Copy data from old blocks to new blocks
-            
-            lseek(global_fd, (old_start_block + j) * 1024, SEEK_SET);
-            read(global_fd, temp_buf + j* 1024, 1024);
-            //printf("Defrag: old block %d, char: %c\n", j + old_start_block, temp_buf[j]);
-        }
-
-        //printf("Defrag: buffer %s\n",temp_buf);
-
-        //Update the free block list: clear old blocks
-        for (int j = old_start_block; j < old_start_block + file_size; j++) {
-            //printf("Defrag: clear block %d\n", j);
-            superblock.free_block_list[j / 8] &= ~(1 << (7 - (j % 8)));
-            uint8_t zeroes[1024] = {0};
-            memset(zeroes, 0, 1024);
-            lseek(global_fd, j * 1024, SEEK_SET);
-            write(global_fd, zeroes, 1024);
-        }
-
-        //Mark new blocks as used
-        for (int j = next_free_block; j < next_free_block + file_size; j++) {
-            superblock.free_block_list[j / 8] |= (1 << (7 - (j % 8)));
-            
-        }
+        // Queue the copy from old blocks to new blocks; all moves are submitted together in order below
+        moves[move_count++] = (BlockMove){old_start_block, next_free_block, file_size};
+        ra_drop(inode_index);
 
-        for (int j = 0; j < file_size; j++) {
-            // Copy data from old blocks to new blocks
-            //printf("Defrag: copy block %d\n", j + next_free_block);
-            lseek(global_fd, (j + next_free_block) * 1024, SEEK_SET);
-            write(global_fd, temp_buf + j*1024, 1024);
-        }
+        // Update the free block list: clear old blocks, then mark new blocks as used
+        release_blocks(old_start_block, file_size);
+        claim_blocks(next_free_block, file_size);
 
         // Update the inode's start block
-        inode->start_block = next_free_block;
-        free(temp_buf);
+        inodes.start[inode_index] = next_free_block;
+        handles_refresh(inode_index);
 
         // Advance the next free block pointer
         next_free_block += file_size;
     }
-    
-    write_superblock();
+
+    // Data moves and old blocks are zeroed in order, so a file may land on blocks the previous one vacated
+    blkdev_move_blocks(disk, moves, move_count);
+    mark_superblock_dirty();
 }
 
 
@@ -852,56 +1188,23 @@ void fs_defrag(void){
 * directory, print the following error message to stderr:
 * Error: Directory <directory name> does not exist
 * 
-* You can assume that the given name does not contain a slash or backslash character
+* The name may also be a path of several components separated by slashes, relative to the current working
+* directory or, with a leading slash, to the root (see resolve_parent).
 */
 void fs_cd(char name[5]){
     if (!fs_mounted) {
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
-    // Handle special case for '.' (current directory)
-    if (strncmp(name, ".", 5) == 0) {
-        return; // No change needed
-    }
-
-    // Handle special case for '..' (parent directory)
-    if (strncmp(name, "..", 5) == 0) {
-        if (cwd == 0) {
-            // Already in the root directory, no change
-            return;
-        }
-        // Set cwd to the parent directory
-        int p = superblock.inode[cwd].dir_parent & 0x7F;
-        if (p ==127){
-            cwd = 0;
-        }
-        else{
-            cwd = p;
-        }
-        //printf("Debug 1: %i\n", cwd);
+    // Resolve every component, following . and .. on the way; "/" alone is the root
+    int pd, dir = -1;
+    char leaf[6];
+    if (resolve_parent(name, &pd, leaf, NULL) == 0) dir = (leaf[0] == '\0') ? pd : step_dir(pd, leaf);
+    if (dir >= 0) {
+        cwd = (dir == 127) ? 0 : dir;
         return;
     }
 
-    // Search for the directory with the given name in the current working directory
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        int pd = (cwd == 0) ? 127 : cwd;
-
-        // Check if the inode is in use and matches the current working directory
-        if ((inode->used_size & 0x80) && // Inode is in use
-            (inode->dir_parent & 0x7F) == pd && // Belongs to current directory
-            strncmp(inode->name, name, 5) == 0) { // Name matches
-            if (inode->dir_parent & 0x80) { // It's a directory
-                cwd = i; // Change to the new directory
-                return;
-            } else {
-                //printf("Debug 2: %i\n", cwd);
-                fprintf(stderr, "Error: Directory %s does not exist\n", name);
-                return;
-            }
-        }
-    }
-
     // If no matching directory is found
     //printf("Debug 3: %i\n", cwd);
     fprintf(stderr, "Error: Directory %s does not exist\n", name);
@@ -909,18 +1212,116 @@ void fs_cd(char name[5]){
 }
 
 
+/**
+* Writes any pending changes to the superblock of the mounted FFD back to the virtual disk and flushes the
+* disk so that everything written so far is durable. The disk stays marked dirty, since it is still mounted; only a
+* remount or exit marks it clean.
+*/
+void fs_sync(void){
+    if (!fs_mounted) {
+        fprintf(stderr, "Error: No file system is mounted\n");
+        return;
+    }
+    sync_superblock();
+    blkdev_flush(disk);
+}
+
+
+/**
+* Prints the hit, miss and eviction counters of the block cache of the mounted FFD and the read-ahead counters
+* to stdout.
+*/
+void fs_stats(void){
+    if (!fs_mounted) {
+        fprintf(stderr, "Error: No file system is mounted\n");
+        return;
+    }
+    BlockCacheStats stats;
+    if (blkdev_cache_stats(disk, &stats) < 0) {
+        printf("Cache: disabled\n");
+    } else {
+        printf("Cache: %lu hits, %lu misses, %lu evictions, %d frames\n",
+               stats.hits, stats.misses, stats.evictions, stats.frames);
+    }
+    printf("Read-ahead: %lu hits, %lu windows\n", ra_hits, ra_fills);
+    int used = bitmap_count_set(free_map(superblock), 128, 1, 127);
+    printf("Blocks: %d used, %d free\n", used, 127 - used);
+    printf("Scan: %s\n", scan_kernel());
+    printf("Checksum: crc32c, %s\n", crc32c_kernel());
+}
+
+
+/**
+ * Check a name or path argument: every component between slashes has at most 5 characters.
+ */
+static int valid_path(const char *path) {
+    while (*path) {
+        int len = strcspn(path, "/");
+        if (len > 5) return 0;
+        path += len;
+        if (*path == '/') path++;
+    }
+    return 1;
+}
+
 /**
 * MAIN for handling input commands
+*
+* Usage: fs [-w] [-m] [-u] [-f] [-c frames] [-r blocks] [-j threads] <command file>
+*   -w  write the superblock through to disk after every change instead of on sync/remount/exit
+*   -m  mount disks with a shared memory mapping, so block reads and writes are memory copies
+*   -u  submit the block relocations of E and O through io_uring (falls back to pread/pwrite)
+*   -c  number of 1 KB frames in the block cache (default 32, 0 disables the cache)
+*   -r  largest sequential read-ahead window in blocks (default 32, 0 disables read-ahead)
+*   -j  threads the mount consistency checks run on (default 1, at most 16)
+*   -f  run the mount consistency checks on every mount, also on disks that were unmounted cleanly
 */
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
+    int opt;
+    while ((opt = getopt(argc, argv, "wmufc:r:j:")) != -1) {
+        if (opt == 'w') {
+            write_through = 1;
+        } else if (opt == 'm') {
+            use_mmap = 1;
+        } else if (opt == 'u') {
+            use_uring = 1;
+        } else if (opt == 'f') {
+            force_check = 1;
+        } else if (opt == 'c') {
+            char *end;
+            cache_frames = strtol(optarg, &end, 10);
+            if (*end != '\0' || cache_frames < 0) {
+                fprintf(stderr, "Command Error: , 0\n");
+                return 1;
+            }
+        } else if (opt == 'r') {
+            char *end;
+            ra_max = strtol(optarg, &end, 10);
+            if (*end != '\0' || ra_max < 0) {
+                fprintf(stderr, "Command Error: , 0\n");
+                return 1;
+            }
+        } else if (opt == 'j') {
+            char *end;
+            check_threads = strtol(optarg, &end, 10);
+            if (*end != '\0' || check_threads < 1 || check_threads > CHECK_MAX_THREADS) {
+                fprintf(stderr, "Command Error: , 0\n");
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Command Error: , 0\n");
+            return 1;
+        }
+    }
+    if (argc - optind != 1) {
         fprintf(stderr, "Command Error: , 0\n");
         return 1;
     }
+    char *cmd_path = argv[optind];
 
-    FILE *cmd_file = fopen(argv[1], "r");
+    FILE *cmd_file = fopen(cmd_path, "r");
     if (!cmd_file) {
-        fprintf(stderr, "Command Error: %s, 0\n", argv[1]);
+        fprintf(stderr, "Command Error: %s, 0\n", cmd_path);
         return 1;
     }
 
@@ -935,7 +1336,7 @@ int main(int argc, char *argv[]) {
         args_read = sscanf(line, " %c", &cmd);
 
         if (args_read != 1) {
-            fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+            fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
             continue;
         }
 
@@ -943,7 +1344,7 @@ int main(int argc, char *argv[]) {
         if (cmd == 'M') {
             // M <disk>
             if (sscanf(line, " %*c %1024s", arg1) != 1) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
             fs_mount(arg1);
@@ -952,19 +1353,19 @@ int main(int argc, char *argv[]) {
             // C <file> <size>
             int sz;
             if (sscanf(line, " %*c %1024s %d", arg1, &sz) != 2) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
-            if (strlen(arg1) > 5 || sz < 0 || sz > 127) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+            if (!valid_path(arg1) || sz < 0 || sz > 127) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
             fs_create(arg1, sz);
 
         } else if (cmd == 'D') {
             // D <file>
-            if (sscanf(line, " %*c %1024s", arg1) != 1 || strlen(arg1) > 5) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+            if (sscanf(line, " %*c %1024s", arg1) != 1 || !valid_path(arg1)) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
             fs_delete(arg1);
@@ -973,11 +1374,11 @@ int main(int argc, char *argv[]) {
             // R <file> <block_num>
             int blk;
             if (sscanf(line, " %*c %1024s %d", arg1, &blk) != 2) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
-            if (strlen(arg1) > 5 || blk < 0 || blk > 127) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+            if (!valid_path(arg1) || blk < 0 || blk > 127) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
             fs_read(arg1, blk);
@@ -986,28 +1387,80 @@ int main(int argc, char *argv[]) {
             // W <file> <block_num>
             int blk;
             if (sscanf(line, " %*c %1024s %d", arg1, &blk) != 2) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
-            if (strlen(arg1) > 5 || blk < 0 || blk > 127) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+            if (!valid_path(arg1) || blk < 0 || blk > 127) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
             fs_write(arg1, blk);
 
+        } else if (cmd == 'F') {
+            // F <file>
+            if (sscanf(line, " %*c %1024s", arg1) != 1 || !valid_path(arg1)) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
+                continue;
+            }
+            int handle = fs_open(arg1);
+            if (handle >= 0) printf("%d\n", handle);
+
+        } else if (cmd == 'X') {
+            // X <handle>
+            int handle;
+            if (sscanf(line, " %*c %d", &handle) != 1) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
+                continue;
+            }
+            fs_close(handle);
+
+        } else if (cmd == 'r' || cmd == 'w') {
+            // r <handle> <block_num>, w <handle> <block_num>
+            int handle, blk;
+            if (sscanf(line, " %*c %d %d", &handle, &blk) != 2 || blk < 0 || blk > 127) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
+                continue;
+            }
+            if (cmd == 'r') fs_read_handle(handle, blk);
+            else fs_write_handle(handle, blk);
+
+        } else if (cmd == 'G') {
+            // G <file> [<first_block> <count>]
+            int first = 0, count = 0;
+            int n = sscanf(line, " %*c %1024s %d %d", arg1, &first, &count);
+            if ((n != 1 && n != 3) || !valid_path(arg1) || first < 0 || first > 127 ||
+                (n == 3 && (count < 1 || count > 127))) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
+                continue;
+            }
+            fs_read_range(arg1, first, count);
+
+        } else if (cmd == 'P') {
+            // P <file> <first_block> <count>
+            int first, count;
+            if (sscanf(line, " %*c %1024s %d %d", arg1, &first, &count) != 3) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
+                continue;
+            }
+            if (!valid_path(arg1) || first < 0 || first > 127 || count < 1 || count > 127) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
+                continue;
+            }
+            fs_write_range(arg1, first, count);
+
         } else if (cmd == 'B') {
             // B <new buffer characters>
             // copy rest of line as buffer (trimming newline)
             char *p = strchr(line, ' ');
             if (!p) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
             p++;
             size_t len = strlen(p);
             if (len > 0 && p[len-1] == '\n') p[len-1] = '\0';
             if (strlen(p) > 1024) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
             fs_buff(p);
@@ -1017,7 +1470,7 @@ int main(int argc, char *argv[]) {
             char extra[10];
             if (sscanf(line, " %*c %9s", extra) == 1) {
                 // extra args found
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
             fs_ls();
@@ -1026,11 +1479,11 @@ int main(int argc, char *argv[]) {
             // E <file> <new_size>
             int new_sz;
             if (sscanf(line, " %*c %1024s %d", arg1, &new_sz) != 2) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
-            if (strlen(arg1) > 5 || new_sz < 1 || new_sz > 127) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+            if (!valid_path(arg1) || new_sz < 1 || new_sz > 127) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
             fs_resize(arg1, new_sz);
@@ -1040,15 +1493,15 @@ int main(int argc, char *argv[]) {
             char extra[10];
             if (sscanf(line, " %*c %9s", extra) == 1) {
                 // extra args found
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
             fs_defrag();
 
         } else if (cmd == 'Y') {
             // Y <directory name>
-            if (sscanf(line, " %*c %1024s", arg1) != 1 || strlen(arg1) > 5) {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+            if (sscanf(line, " %*c %1024s", arg1) != 1 || !valid_path(arg1)) {
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
 
@@ -1056,18 +1509,40 @@ int main(int argc, char *argv[]) {
             int extra_matched = sscanf(line, " %*c %*s %1024s", extra);
             if (extra_matched == 1) {
                 // Extra argument found
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
                 continue;
             }
 
             fs_cd(arg1);
 
+        } else if (cmd == 'I') {
+            // I
+            char extra[10];
+            if (sscanf(line, " %*c %9s", extra) == 1) {
+                // extra args found
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
+                continue;
+            }
+            fs_stats();
+
+        } else if (cmd == 'S') {
+            // S
+            char extra[10];
+            if (sscanf(line, " %*c %9s", extra) == 1) {
+                // extra args found
+                fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
+                continue;
+            }
+            fs_sync();
+
         } else {
             // Invalid command
-            fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_num);
+            fprintf(stderr, "Command Error: %s, %d\n", cmd_path, line_num);
         }
     }
 
     fclose(cmd_file);
+    flush_clean();
+    unmount_disk(disk, superblock);
     return 0;
 }
\ No newline at end of file
@@ -20,10 +20,18 @@ void fs_create(char name[5], int size);
 void fs_delete(char name[5]);
 void fs_read(char name[5], int block_num);
 void fs_write(char name[5], int block_num);
+void fs_read_range(char name[5], int first_block, int count);
+void fs_write_range(char name[5], int first_block, int count);
+int fs_open(char name[5]);
+void fs_close(int handle);
+void fs_read_handle(int handle, int block_num);
+void fs_write_handle(int handle, int block_num);
 void fs_buff(char buff[1024]);
 void fs_ls(void);
 void fs_resize(char name[5], int new_size);
 void fs_defrag(void);
 void fs_cd(char name[5]);
+void fs_sync(void);
+void fs_stats(void);
 
 # endif
\ No newline at end of file
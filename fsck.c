@@ -0,0 +1,264 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "check.h"
+#include "bitmap.h"
+#include "inodetab.h"
+#include "trailer.h"
+
+/**
+ * Standalone consistency checker for virtual disks.
+ *
+ * Reports every violation of the six mount checks instead of only the first one, and can repair a disk so that it
+ * passes them all. Every step is a constant number of passes over the 126 inodes and 128 blocks, so thousands of
+ * disks can be swept in one run.
+ */
+
+static int quiet = 0;   // Only print one summary line per disk
+static int dry_run = 0; // Report the repairs without writing them
+
+static void print_violation(const char *disk, const Superblock *sb, const InodeTable *t, const CheckViolation *v) {
+    if (quiet) return;
+    int i = v->inode;
+    char name[5];
+    if (i >= 0) inode_name_unpack(t->name[i], name);
+    switch (v->check) {
+    case 1:
+        printf("%s: inode %d: check 1: free inode is not all zero\n", disk, i);
+        break;
+    case 2:
+        printf("%s: inode %d: check 2: file %.5s has blocks %d to %d, outside 1 to 127\n", disk, i, name,
+               t->start[i], t->start[i] + t->size[i] - 1);
+        break;
+    case 3:
+        printf("%s: inode %d: check 3: directory %.5s has start block %d and size %d\n", disk, i, name, t->start[i],
+               t->size[i]);
+        break;
+    case 4:
+        printf("%s: inode %d: check 4: parent %d of %.5s is not a directory in use\n", disk, i, t->parent[i], name);
+        break;
+    case 5:
+        printf("%s: inode %d: check 5: name %.5s is already used by inode %d in the same directory\n", disk, i, name,
+               v->other);
+        break;
+    case 6:
+        if (!bitmap_test((const uint8_t *)sb->free_block_list, v->block)) {
+            printf("%s: block %d: check 6: marked free but allocated to inode %d\n", disk, v->block, i);
+        } else if (v->other == 0) {
+            printf("%s: block %d: check 6: marked used but not allocated to any file\n", disk, v->block);
+        } else {
+            printf("%s: block %d: check 6: allocated to %d files, first inode %d\n", disk, v->block, v->other, i);
+        }
+        break;
+    }
+}
+
+static void print_repair(const char *disk, const char *what, int i) {
+    if (!quiet) printf("%s: %s inode %d: %s\n", disk, dry_run ? "would repair" : "repair", i, what);
+}
+
+static void drop_inode(const char *disk, InodeTable *t, int i, const char *why) {
+    print_repair(disk, why, i);
+    inode_table_clear(t, i);
+}
+
+/**
+ * Give inode i a name that is not in names yet, made of the start of its name, '~' and a number.
+ */
+static void rename_inode(const char *disk, InodeTable *t, int i, uint64_t *names) {
+    char old[6] = {0}, fresh[16];
+    inode_name_unpack(t->name[i], old);
+    for (int k = 1;; k++) {
+        int digits = snprintf(NULL, 0, "%d", k);
+        snprintf(fresh, sizeof(fresh), "%.*s~%d", 4 - digits, old, k);
+        t->name[i] = inode_name_pack(fresh);
+        if (!name_set_add(names, name_set_key(t, i))) break;
+    }
+    if (!quiet) {
+        printf("%s: %s inode %d: rename %.5s to %s\n", disk, dry_run ? "would repair" : "repair", i, old, fresh);
+    }
+}
+
+/**
+ * Make sb and t pass every mount check. Returns the number of repairs.
+ *
+ * Inodes are repaired first: junk in free inodes is cleared, files with blocks outside the disk are dropped and
+ * directories get a zero start block and size. Then everything that cannot be reached from the root through
+ * directories in use is dropped, along with every file that shares a block with a lower-numbered one. Duplicate
+ * names are renamed, keeping the lowest inode under its name, and finally the free block list is rebuilt from the
+ * files that are left.
+ */
+static int repair(const char *disk, Superblock *sb, InodeTable *t) {
+    int repairs = 0;
+
+    for (int i = 0; i < INODE_COUNT; i++) {
+        int failed = check_inode(t, i);
+        if (failed & CHECK_BIT(1)) {
+            drop_inode(disk, t, i, "clear free inode");
+            repairs++;
+        } else if (failed & CHECK_BIT(2)) {
+            drop_inode(disk, t, i, "drop file with blocks outside the disk");
+            repairs++;
+        } else if (failed & CHECK_BIT(3)) {
+            print_repair(disk, "reset start block and size of directory", i);
+            t->start[i] = t->size[i] = 0;
+            repairs++;
+        }
+    }
+
+    // Walk the tree from the root; parent 127 is the root
+    int head[INODE_COUNT + 2], next[INODE_COUNT], queue[INODE_COUNT];
+    uint8_t reached[INODE_COUNT] = {0};
+    for (int p = 0; p < INODE_COUNT + 2; p++) head[p] = -1;
+    for (int i = INODE_COUNT - 1; i >= 0; i--) {
+        if (!t->used[i]) continue;
+        next[i] = head[t->parent[i]];
+        head[t->parent[i]] = i;
+    }
+    int qn = 0;
+    for (int c = head[127]; c >= 0; c = next[c]) queue[qn++] = c;
+    for (int q = 0; q < qn; q++) {
+        int i = queue[q];
+        reached[i] = 1;
+        if (!t->is_dir[i]) continue;
+        for (int c = head[i]; c >= 0; c = next[c]) queue[qn++] = c;
+    }
+    for (int i = 0; i < INODE_COUNT; i++) {
+        if (t->used[i] && !reached[i]) {
+            drop_inode(disk, t, i, "drop orphan");
+            repairs++;
+        }
+    }
+
+    uint8_t owner[CHECK_BLOCKS];
+    memset(owner, 0xFF, sizeof(owner));
+    for (int i = 0; i < INODE_COUNT; i++) {
+        if (!t->used[i] || t->is_dir[i]) continue;
+        int start = t->start[i], end = t->start[i] + t->size[i], shared = 0;
+        for (int b = start; b < end; b++) shared |= (owner[b] != 0xFF);
+        if (shared) {
+            drop_inode(disk, t, i, "drop file that shares blocks with a lower inode");
+            repairs++;
+            continue;
+        }
+        for (int b = start; b < end; b++) owner[b] = i;
+    }
+
+    // A rename can clash with a later original name, so every original name is in the set before the first rename
+    uint64_t names[NAME_SET_SLOTS] = {0};
+    uint8_t duplicate[INODE_COUNT] = {0};
+    for (int i = 0; i < INODE_COUNT; i++) {
+        if (t->used[i]) duplicate[i] = name_set_add(names, name_set_key(t, i));
+    }
+    for (int i = 0; i < INODE_COUNT; i++) {
+        if (duplicate[i]) {
+            rename_inode(disk, t, i, names);
+            repairs++;
+        }
+    }
+
+    uint8_t rebuilt[CHECK_BLOCKS / 8] = {0};
+    bitmap_set_range(rebuilt, CHECK_BLOCKS, 0, 1);
+    for (int b = 1; b < CHECK_BLOCKS; b++) {
+        if (owner[b] != 0xFF && t->used[owner[b]]) bitmap_set_range(rebuilt, CHECK_BLOCKS, b, 1);
+    }
+    if (memcmp(rebuilt, sb->free_block_list, sizeof(rebuilt)) != 0) {
+        if (!quiet) printf("%s: %s: rebuild free block list\n", disk, dry_run ? "would repair" : "repair");
+        memcpy(sb->free_block_list, rebuilt, sizeof(rebuilt));
+        repairs++;
+    }
+    return repairs;
+}
+
+/**
+ * Check one disk and repair it if asked to. Returns 0 if it ends up consistent, 1 if violations are left and 2 if the
+ * disk cannot be read or written.
+ */
+static int fsck_disk(const char *disk, int fix) {
+    int fd = open(disk, (fix && !dry_run) ? O_RDWR : O_RDONLY);
+    Superblock sb;
+    if (fd < 0 || pread(fd, &sb, sizeof(sb), 0) != sizeof(sb)) {
+        fprintf(stderr, "Error: Cannot read disk %s\n", disk);
+        if (fd >= 0) close(fd);
+        return 2;
+    }
+    ImageTrailer trailer;
+    int has_trailer = (trailer_read(fd, &trailer) == 0);
+    if (has_trailer && trailer.checksum != trailer_checksum(&sb) && !quiet) {
+        printf("%s: superblock does not match its checksum\n", disk);
+    }
+
+    InodeTable t;
+    inode_table_load(&t, &sb);
+    CheckViolation found[CHECK_MAX_VIOLATIONS];
+    int n = check_all(&sb, &t, found);
+    for (int k = 0; k < n; k++) print_violation(disk, &sb, &t, &found[k]);
+    if (n == 0 || !fix) {
+        if (n == 0) {
+            printf("%s: consistent\n", disk);
+        } else {
+            printf("%s: %d violation%s\n", disk, n, n == 1 ? "" : "s");
+        }
+        close(fd);
+        return n ? 1 : 0;
+    }
+
+    int repairs = repair(disk, &sb, &t);
+    inode_table_store(&t, &sb);
+    inode_table_load(&t, &sb);
+    int left = check_all(&sb, &t, found);
+    printf("%s: %d violation%s, %d repair%s%s, %d left\n", disk, n, n == 1 ? "" : "s", repairs,
+           repairs == 1 ? "" : "s", dry_run ? " not written" : "", left);
+
+    int status = left ? 1 : 0;
+    if (!dry_run) {
+        // The next mount runs the full checks, as after any change made outside fs
+        trailer.clean = 0;
+        trailer.checksum = trailer_checksum(&sb);
+        if (pwrite(fd, &sb, sizeof(sb), 0) != sizeof(sb) || (has_trailer && trailer_write(fd, &trailer) < 0) ||
+            fdatasync(fd) < 0) {
+            fprintf(stderr, "Error: Cannot write disk %s: %s\n", disk, strerror(errno));
+            status = 2;
+        }
+    }
+    close(fd);
+    return status;
+}
+
+/**
+ * Usage: fsck [-r] [-n] [-q] <disk>...
+ *   -r  repair the disks so that they pass every mount check
+ *   -n  with -r, report the repairs without writing them
+ *   -q  only print one summary line per disk
+ *
+ * Exits with 0 if every disk is consistent (after repair with -r), 1 if a disk still has violations and 2 if a disk
+ * cannot be read or written.
+ */
+int main(int argc, char *argv[]) {
+    int fix = 0, opt;
+    while ((opt = getopt(argc, argv, "rnq")) != -1) {
+        if (opt == 'r') {
+            fix = 1;
+        } else if (opt == 'n') {
+            dry_run = 1;
+        } else if (opt == 'q') {
+            quiet = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-r] [-n] [-q] <disk>...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind == argc || (dry_run && !fix)) {
+        fprintf(stderr, "Usage: %s [-r] [-n] [-q] <disk>...\n", argv[0]);
+        return 2;
+    }
+    int status = 0;
+    for (int k = optind; k < argc; k++) {
+        int s = fsck_disk(argv[k], fix);
+        if (s > status) status = s;
+    }
+    return status;
+}
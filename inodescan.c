@@ -0,0 +1,163 @@
+#include <string.h>
+#include "inodescan.h"
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/**
+ * Vectorized matching of inodes against a key.
+ *
+ * An inode is 8 bytes, so the packed inode table is scanned as an array of 64-bit words: every word is ANDed with a
+ * mask selecting the fields of interest and compared with the key, two words at a time with SSE2 or four at a time
+ * with AVX2 when the CPU supports it. Words come from scan_pack, which zeroes the name bytes after the first NUL so
+ * that one comparison gives the same answer as strncmp. A field of the decoded table in inodetab.h is one byte per
+ * inode and is compared with a value 16 bytes at a time with SSE2 or 32 with AVX2. Both kernels are chosen on the
+ * first call.
+ */
+
+// Kernels match entries first to n - 1, where first is a multiple of the vector width so vector results never
+// straddle two words of matches
+typedef void (*MatchKernel)(const uint64_t *words, int first, int n, uint64_t key, uint64_t mask, uint64_t *matches);
+typedef void (*ByteKernel)(const uint8_t *bytes, int first, int n, uint8_t value, uint64_t *matches);
+
+static MatchKernel kernel = NULL;
+static ByteKernel byte_kernel = NULL;
+static const char *kernel_name = NULL;
+
+/**
+ * Pack inode into the word a scan compares, with the name cut at its first NUL.
+ */
+uint64_t scan_pack(const Inode *inode) {
+    Inode copy = *inode;
+    int end = strnlen(copy.name, 5);
+    memset(copy.name + end, 0, 5 - end);
+    uint64_t word;
+    memcpy(&word, &copy, sizeof(word));
+    return word;
+}
+
+/**
+ * Build the mask that selects the given SCAN_ fields of a packed inode.
+ */
+uint64_t scan_mask(int fields) {
+    Inode m;
+    memset(&m, 0, sizeof(m));
+    if (fields & SCAN_NAME) memset(m.name, 0xFF, 5);
+    if (fields & SCAN_USED) m.used_size |= 0x80;
+    if (fields & SCAN_SIZE) m.used_size |= 0x7F;
+    if (fields & SCAN_START) m.start_block = 0xFF;
+    if (fields & SCAN_DIR) m.dir_parent |= 0x80;
+    if (fields & SCAN_PARENT) m.dir_parent |= 0x7F;
+    uint64_t word;
+    memcpy(&word, &m, sizeof(word));
+    return word;
+}
+
+static void match_scalar(const uint64_t *words, int first, int n, uint64_t key, uint64_t mask, uint64_t *matches) {
+    for (int i = first; i < n; i++) {
+        if ((words[i] & mask) == key) matches[i / 64] |= 1ull << (i % 64);
+    }
+}
+
+static void match_bytes_scalar(const uint8_t *bytes, int first, int n, uint8_t value, uint64_t *matches) {
+    for (int i = first; i < n; i++) {
+        if (bytes[i] == value) matches[i / 64] |= 1ull << (i % 64);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+static void match_sse2(const uint64_t *words, int first, int n, uint64_t key, uint64_t mask, uint64_t *matches) {
+    __m128i k = _mm_set1_epi64x(key), m = _mm_set1_epi64x(mask);
+    int i = first;
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(words + i)), m);
+        // SSE2 has no 64-bit compare: a word matches if both of its 32-bit halves do
+        __m128i eq = _mm_cmpeq_epi32(v, k);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        uint64_t bits = _mm_movemask_pd(_mm_castsi128_pd(eq));
+        matches[i / 64] |= bits << (i % 64);
+    }
+    match_scalar(words, i, n, key, mask, matches);
+}
+
+__attribute__((target("avx2")))
+static void match_avx2(const uint64_t *words, int first, int n, uint64_t key, uint64_t mask, uint64_t *matches) {
+    __m256i k = _mm256_set1_epi64x(key), m = _mm256_set1_epi64x(mask);
+    int i = first;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(words + i)), m);
+        uint64_t bits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, k)));
+        matches[i / 64] |= bits << (i % 64);
+    }
+    match_sse2(words, i, n, key, mask, matches);
+}
+
+static void match_bytes_sse2(const uint8_t *bytes, int first, int n, uint8_t value, uint64_t *matches) {
+    __m128i v = _mm_set1_epi8(value);
+    int i = first;
+    for (; i + 16 <= n; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(bytes + i)), v);
+        uint64_t bits = (uint16_t)_mm_movemask_epi8(eq);
+        matches[i / 64] |= bits << (i % 64);
+    }
+    match_bytes_scalar(bytes, i, n, value, matches);
+}
+
+__attribute__((target("avx2")))
+static void match_bytes_avx2(const uint8_t *bytes, int first, int n, uint8_t value, uint64_t *matches) {
+    __m256i v = _mm256_set1_epi8(value);
+    int i = first;
+    for (; i + 32 <= n; i += 32) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(bytes + i)), v);
+        uint64_t bits = (uint32_t)_mm256_movemask_epi8(eq);
+        matches[i / 64] |= bits << (i % 64);
+    }
+    match_bytes_sse2(bytes, i, n, value, matches);
+}
+#endif
+
+static void choose_kernel(void) {
+    kernel = match_scalar;
+    byte_kernel = match_bytes_scalar;
+    kernel_name = "scalar";
+#ifdef HAVE_X86_SIMD
+    kernel = match_sse2;
+    byte_kernel = match_bytes_sse2;
+    kernel_name = "sse2";
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = match_avx2;
+        byte_kernel = match_bytes_avx2;
+        kernel_name = "avx2";
+    }
+#endif
+}
+
+/**
+ * Set bit i % 64 of matches[i / 64] for every word i of the n words with (words[i] & mask) == key, and clear all
+ * other bits of the (n + 63) / 64 words of matches.
+ */
+void scan_match(const uint64_t *words, int n, uint64_t key, uint64_t mask, uint64_t *matches) {
+    if (!kernel) choose_kernel();
+    memset(matches, 0, (n + 63) / 64 * sizeof(uint64_t));
+    kernel(words, 0, n, key & mask, mask, matches);
+}
+
+/**
+ * Set bit i % 64 of matches[i / 64] for every byte i of the n bytes equal to value, and clear all other bits of the
+ * (n + 63) / 64 words of matches.
+ */
+void scan_match_bytes(const uint8_t *bytes, int n, uint8_t value, uint64_t *matches) {
+    if (!kernel) choose_kernel();
+    memset(matches, 0, (n + 63) / 64 * sizeof(uint64_t));
+    byte_kernel(bytes, 0, n, value, matches);
+}
+
+/**
+ * Name of the kernels scan_match and scan_match_bytes use on this CPU.
+ */
+const char *scan_kernel(void) {
+    if (!kernel) choose_kernel();
+    return kernel_name;
+}
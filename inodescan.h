@@ -0,0 +1,21 @@
+#ifndef INODESCAN_H
+#define INODESCAN_H
+
+#include <stdint.h>
+#include "fs-sim.h"
+
+// Fields of an inode that a scan compares
+#define SCAN_NAME   0x1 // Name, up to its first NUL
+#define SCAN_USED   0x2 // In-use bit of used_size
+#define SCAN_SIZE   0x4 // Size bits of used_size
+#define SCAN_START  0x8 // start_block
+#define SCAN_DIR    0x10 // Directory bit of dir_parent
+#define SCAN_PARENT 0x20 // Parent bits of dir_parent
+
+uint64_t scan_pack(const Inode *inode);
+uint64_t scan_mask(int fields);
+void scan_match(const uint64_t *words, int n, uint64_t key, uint64_t mask, uint64_t *matches);
+void scan_match_bytes(const uint8_t *bytes, int n, uint8_t value, uint64_t *matches);
+const char *scan_kernel(void);
+
+#endif
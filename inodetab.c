@@ -0,0 +1,63 @@
+#include <string.h>
+#include "inodetab.h"
+
+/**
+ * Decode the inode table of sb into t.
+ */
+void inode_table_load(InodeTable *t, const Superblock *sb) {
+    for (int i = 0; i < INODE_COUNT; i++) {
+        const Inode *inode = &sb->inode[i];
+        t->used[i] = inode->used_size >> 7;
+        t->size[i] = inode->used_size & 0x7F;
+        t->start[i] = inode->start_block;
+        t->is_dir[i] = inode->dir_parent >> 7;
+        t->parent[i] = inode->dir_parent & 0x7F;
+        uint64_t name = 0;
+        for (int j = 0; j < 5; j++) name |= (uint64_t)(uint8_t)inode->name[j] << (8 * j);
+        t->name[i] = name;
+    }
+}
+
+/**
+ * Encode t back into the inode table of sb.
+ */
+void inode_table_store(const InodeTable *t, Superblock *sb) {
+    for (int i = 0; i < INODE_COUNT; i++) {
+        Inode *inode = &sb->inode[i];
+        inode_name_unpack(t->name[i], inode->name);
+        inode->used_size = (t->used[i] << 7) | t->size[i];
+        inode->start_block = t->start[i];
+        inode->dir_parent = (t->is_dir[i] << 7) | t->parent[i];
+    }
+}
+
+/**
+ * Zero every field of inode i.
+ */
+void inode_table_clear(InodeTable *t, int i) {
+    t->used[i] = t->size[i] = t->start[i] = t->is_dir[i] = t->parent[i] = 0;
+    t->name[i] = 0;
+}
+
+/**
+ * Pack a name of at most 5 characters, stopping at the first NUL like strncpy does.
+ */
+uint64_t inode_name_pack(const char *name) {
+    uint64_t packed = 0;
+    for (int j = 0; j < 5 && name[j] != '\0'; j++) packed |= (uint64_t)(uint8_t)name[j] << (8 * j);
+    return packed;
+}
+
+/**
+ * Zero the bytes of a stored name that follow its first NUL, so that equal keys mean strncmp equal names.
+ */
+uint64_t inode_name_canonical(uint64_t name) {
+    for (int j = 0; j < 5; j++) {
+        if (((name >> (8 * j)) & 0xFF) == 0) return name & ((1ull << (8 * j)) - 1);
+    }
+    return name;
+}
+
+void inode_name_unpack(uint64_t name, char out[5]) {
+    for (int j = 0; j < 5; j++) out[j] = (char)(name >> (8 * j));
+}
@@ -0,0 +1,27 @@
+#ifndef INODETAB_H
+#define INODETAB_H
+
+#include <stdint.h>
+#include "fs-sim.h"
+
+#define INODE_COUNT 126
+
+// In-memory copy of the inode table with every field of an Inode decoded into its own array, so scans read dense
+// arrays of plain values instead of unpacking bit fields. Together the arrays hold every bit of the packed table.
+typedef struct {
+	uint8_t used[INODE_COUNT];   // In-use bit of used_size
+	uint8_t size[INODE_COUNT];   // File size in blocks, low bits of used_size
+	uint8_t start[INODE_COUNT];  // start_block
+	uint8_t is_dir[INODE_COUNT]; // Directory bit of dir_parent
+	uint8_t parent[INODE_COUNT]; // Parent index, low bits of dir_parent; 127 is the root
+	uint64_t name[INODE_COUNT];  // The 5 name bytes as stored, name[0] in the lowest byte
+} InodeTable;
+
+void inode_table_load(InodeTable *t, const Superblock *sb);
+void inode_table_store(const InodeTable *t, Superblock *sb);
+void inode_table_clear(InodeTable *t, int i);
+uint64_t inode_name_pack(const char *name);
+uint64_t inode_name_canonical(uint64_t name);
+void inode_name_unpack(uint64_t name, char out[5]);
+
+#endif
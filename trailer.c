@@ -0,0 +1,51 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "trailer.h"
+#include "crc32c.h"
+
+/**
+ * Clean-unmount marker of a virtual disk.
+ *
+ * Every superblock write also stores its CRC32C in the trailer, so a mount can tell in about a microsecond whether the
+ * superblock is still the one this program last wrote. The first superblock change of a mount marks the trailer dirty
+ * and an orderly flush marks it clean again. A later mount that finds the trailer clean and the checksum matching
+ * knows the superblock was written from a consistent state, and can skip the consistency checks.
+ */
+
+/**
+ * Read the trailer of the disk file fd. Returns 0 on success, -1 if the file has no trailer of this version, in which
+ * case t is zeroed.
+ */
+int trailer_read(int fd, ImageTrailer *t) {
+    ssize_t n;
+    do {
+        n = pread(fd, t, sizeof(*t), TRAILER_OFFSET);
+    } while (n < 0 && errno == EINTR);
+    if (n != sizeof(*t) || memcmp(t->magic, TRAILER_MAGIC, 4) != 0 || t->version != TRAILER_VERSION) {
+        memset(t, 0, sizeof(*t));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Write t as the trailer of the disk file fd, extending the file if it has none yet.
+ */
+int trailer_write(int fd, const ImageTrailer *t) {
+    ImageTrailer out = *t;
+    memcpy(out.magic, TRAILER_MAGIC, 4);
+    out.version = TRAILER_VERSION;
+    ssize_t n;
+    do {
+        n = pwrite(fd, &out, sizeof(out), TRAILER_OFFSET);
+    } while (n < 0 && errno == EINTR);
+    return (n == sizeof(out)) ? 0 : -1;
+}
+
+/**
+ * CRC32C of the 1 KB superblock.
+ */
+uint32_t trailer_checksum(const void *superblock) {
+    return crc32c(superblock, 1024);
+}
@@ -0,0 +1,26 @@
+#ifndef TRAILER_H
+#define TRAILER_H
+
+#include <stdint.h>
+
+#define TRAILER_OFFSET (128 * 1024) // Right after block 127, outside the 128 blocks of the disk
+#define TRAILER_MAGIC "FSTR"
+#define TRAILER_VERSION 1
+
+// Mount state kept after the last block of a virtual disk. It is first written when a mount changes the superblock,
+// which makes the image 16 bytes longer than 128 blocks; programs that only know the 128-block layout read and write
+// it as before.
+typedef struct {
+	char magic[4];       // TRAILER_MAGIC, not NUL terminated
+	uint8_t version;     // TRAILER_VERSION
+	uint8_t clean;       // 1 if the superblock was flushed in order from a consistent mount, 0 while mounted
+	uint8_t reserved[2];
+	uint32_t generation; // Number of mounts that changed the superblock since the trailer was created
+	uint32_t checksum;   // CRC32C of the superblock as last written
+} ImageTrailer;
+
+int trailer_read(int fd, ImageTrailer *t);
+int trailer_write(int fd, const ImageTrailer *t);
+uint32_t trailer_checksum(const void *superblock);
+
+#endif